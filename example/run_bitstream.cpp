@@ -1,5 +1,5 @@
 // Standalone DODA simulator driver with interactive memory updates
-// Usage: ./run_bitstream <bitstream.txt>
+// Usage: ./run_bitstream <bitstream.txt|bitstream.bin>
 //
 // Commands:
 //   run                  - Execute simulation with current memory
@@ -15,6 +15,7 @@
 #include <string>
 #include <cstdint>
 #include "doda_simulator.hpp"
+#include "doda_bitstream.hpp"
 
 // Static initial memory data - 2D vector [cluster][index]
 // Modify these values as needed for your test cases
@@ -25,38 +26,6 @@ static std::vector<std::vector<int>> g_memory_data = {
     {0, 0, 0, 0, 0, 0, 0, 0}   // Cluster 3
 };
 
-std::vector<std::vector<std::string>> load_bitstream(const std::string& path) {
-    std::vector<std::vector<std::string>> instructions;
-    std::ifstream file(path);
-
-    if (!file.is_open()) {
-        std::cerr << "Error: Cannot open bitstream file: " << path << std::endl;
-        return instructions;
-    }
-
-    std::string line;
-    std::vector<std::string> current_cluster;
-
-    while (std::getline(file, line)) {
-        if (line.empty()) {
-            if (!current_cluster.empty()) {
-                instructions.push_back(current_cluster);
-                current_cluster.clear();
-            }
-        } else if (line[0] == '#') {
-            continue;
-        } else {
-            current_cluster.push_back(line);
-        }
-    }
-
-    if (!current_cluster.empty()) {
-        instructions.push_back(current_cluster);
-    }
-
-    return instructions;
-}
-
 void print_memory(const std::vector<std::vector<int>>& mem) {
     for (size_t c = 0; c < mem.size(); ++c) {
         std::cout << "Cluster " << c << ": [";
@@ -80,24 +49,30 @@ void print_help() {
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <bitstream.txt>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <bitstream.txt|bitstream.bin>" << std::endl;
         return 1;
     }
 
     std::string bitstream_path = argv[1];
 
-    // Load bitstream
+    // Load bitstream (packed binary is memory-mapped, text is parsed once)
     std::cout << "Loading bitstream from: " << bitstream_path << std::endl;
-    auto instructions = load_bitstream(bitstream_path);
+    PackedBitstream instructions;
+    try {
+        instructions = PackedBitstream::load(bitstream_path);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 
     if (instructions.empty()) {
         std::cerr << "Error: No instructions loaded from bitstream file" << std::endl;
         return 1;
     }
 
-    std::cout << "Loaded " << instructions.size() << " cluster(s)" << std::endl;
-    for (size_t i = 0; i < instructions.size(); ++i) {
-        std::cout << "  Cluster " << i << ": " << instructions[i].size() << " instructions" << std::endl;
+    std::cout << "Loaded " << instructions.numClusters() << " cluster(s)" << std::endl;
+    for (int i = 0; i < instructions.numClusters(); ++i) {
+        std::cout << "  Cluster " << i << ": " << instructions.numPePerCluster() << " instructions" << std::endl;
     }
 
     // Initialize simulator
@@ -1,6 +1,7 @@
 // Example: Convert Mapper_Node txt file to bitstream using libdoda_compiler
 #include <iostream>
 #include <doda.h>
+#include "doda_bitstream.hpp"
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
@@ -13,5 +14,20 @@ int main(int argc, char* argv[]) {
 
     std::cout << "Converting " << input_file << " to bitstream..." << std::endl;
 
-    return doda::compileTxtToBitstream(input_file, output_dir) ? 0 : 1;
+    if (!doda::compileTxtToBitstream(input_file, output_dir)) {
+        return 1;
+    }
+
+    // Also emit the packed binary bitstream next to the text one
+    std::string base = input_file.substr(input_file.find_last_of('/') + 1);
+    base = base.substr(0, base.find_last_of('.'));
+    std::string text_path = output_dir + "/" + base + "_bitstream.txt";
+    std::string bin_path = output_dir + "/" + base + "_bitstream.bin";
+    try {
+        PackedBitstream::readText(text_path).writeBinary(bin_path);
+        std::cout << "Packed bitstream written to " << bin_path << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: could not write packed bitstream: " << e.what() << std::endl;
+    }
+    return 0;
 }
@@ -63,10 +63,13 @@ bool compileDFGToBitstream(const std::string& dfg_file, const std::string& outpu
 
 /**
  * Parse a Mapper_Node text file and return a Mapper_DFG
+ * Parsed in the header: libdoda_compiler's Mapper_DFG has an older layout than this one
  * @param txt_file Path to Mapper_Node text file (e.g., DFG_CONV_Mapping.txt)
  * @return Parsed Mapper_DFG structure
  */
-Mapper_DFG parseMappingTxt(const std::string& txt_file);
+inline Mapper_DFG parseMappingTxt(const std::string& txt_file) {
+    return doda_mapping_parser::MappingTxtParser::parse(txt_file);
+}
 
 /**
  * Generate bitstream from a Mapper_Node text file
@@ -45,7 +45,7 @@ inline std::ostream& operator<<(std::ostream& os, const Opcode& opcode) {
     }
 }
 
-Opcode toOpcode(const std::string& op) {
+inline Opcode toOpcode(const std::string& op) {
     static const std::unordered_map<std::string, Opcode> opmap = {
         {"nil", Opcode::NIL},
         {"add", Opcode::ADD},
@@ -3,6 +3,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <nlohmann/json.hpp>
@@ -11,6 +15,11 @@
 
 #define DEBUG
 
+// The prebuilt compiler libraries export their own copies of these classes, with an older layout.
+// Everything below is defined inline and kept out of the dynamic symbol table, so a program or
+// library that includes this header never interposes on those copies, nor they on its.
+#pragma GCC visibility push(hidden)
+
 // Forward declaration
 class Mapper_DFG;
 
@@ -73,14 +82,14 @@ private:
     bool initial_output_used = false;   // Flag to indicate if initial output is used
     int initial_output = 0;             // Initial output value, if used
 
-    inline static int node_counter = 0; // Inline static counter for unique node IDs
-    int pe_idx;
+    int pe_idx;                         // Assigned by the owning Mapper_DFG
 
 public:
-    Mapper_Node() : id(""), op(Opcode::NIL), pe_idx(node_counter++) {}
-    Mapper_Node(const std::string& node_id, Opcode operation, bool initial_output_used = false, int initial_output = -1) 
+    Mapper_Node() : id(""), op(Opcode::NIL), pe_idx(-1) {}
+    Mapper_Node(const std::string& node_id, Opcode operation, bool initial_output_used = false, int initial_output = -1,
+                int pe_index = -1)
         : id(node_id), op(operation), initial_output_used(initial_output_used), initial_output(initial_output),
-            pe_idx(node_counter++) {}
+            pe_idx(pe_index) {}
 
     // Input management
     void add_input(const std::string& type, const std::string& id) {    // source id and type (i1/i2/pred)
@@ -104,8 +113,6 @@ public:
     bool is_initial_output_used() const { return initial_output_used; }
     int get_initial_output() const { return initial_output; }
 
-    static void reset_node_counter() { node_counter = 0; } // Reset counter before constructing a new DFG.
-
     // Setter for PE index (used by parsers that read pre-mapped DFGs)
     void set_pe_index(int idx) { pe_idx = idx; }
 
@@ -117,6 +124,13 @@ public:
 class Mapper_DFG {
 private:
     std::map<std::string, Mapper_Node> m_nodes;
+    int next_pe_idx = 0;    // PE indices are assigned per DFG, so separate DFGs can be built concurrently
+    std::set<int> pinned_pe_idx;    // Indices taken by add_node_in_cluster
+
+    int allocate_pe_idx() {
+        while (pinned_pe_idx.count(next_pe_idx)) next_pe_idx++;
+        return next_pe_idx++;
+    }
 
 public:
     // Node management
@@ -127,7 +141,20 @@ public:
                       << " already exists. Overwriting." << std::endl;
         }
         //m_nodes[id] = Mapper_Node(id, op, initial_output_used, initial_output);
-        m_nodes.emplace(id, Mapper_Node(id, op, initial_output_used, initial_output));
+        m_nodes.emplace(id, Mapper_Node(id, op, initial_output_used, initial_output, allocate_pe_idx()));
+    }
+
+    // Add a node on the first free PE of a given cluster (e.g. a LOAD/STORE next to its SPM bank)
+    void add_node_in_cluster(const std::string& id, Opcode op, int cluster,
+                             bool initial_output_used = false, int initial_output = -1) {
+        const int pes_per_cluster = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER;
+        int pe_idx = std::max(cluster * pes_per_cluster, next_pe_idx);
+        while (pinned_pe_idx.count(pe_idx)) pe_idx++;
+        if (pe_idx >= (cluster + 1) * pes_per_cluster) {
+            throw std::runtime_error("No free PE in cluster " + std::to_string(cluster) + " for node '" + id + "'");
+        }
+        pinned_pe_idx.insert(pe_idx);
+        m_nodes.emplace(id, Mapper_Node(id, op, initial_output_used, initial_output, pe_idx));
     }
 
     // Node access
@@ -160,6 +187,31 @@ public:
     friend class doda_mapper;  // Allow doda_mapper to access private members
 };
 
+// Result of the placement pass (doda_mapper::place_nodes). An edge is a producer-consumer
+// pair of distinct nodes; it is cut when they sit in different clusters, which sets a bit of
+// the producer's DST cluster OH-key and costs an inter-cluster network hop.
+struct PlacementReport {
+    int num_edges = 0;
+    int cut_edges_before = 0;           // With PE indices in creation order
+    int cut_edges = 0;
+    int critical_path_length = 0;       // Nodes on the longest path (loop-carried edges excluded)
+    int critical_hops_before = 0;       // Most cut edges along any longest path
+    int critical_hops = 0;
+    int moved_nodes = 0;
+    int nodes_per_cluster[doda_mapper_utils::BitstreamConstants::NUM_CLUSTER] = {};
+};
+
+// Result of the kernel optimization pipeline (doda_mapper::optimize_kernel): the kernel nodes
+// removed by each pass, summed over its rounds
+struct OptimizationReport {
+    int nodes_before = 0;
+    int constant_folding = 0;           // Nodes with constant operands, and constant chains reassociated into one node
+    int algebraic_identities = 0;       // x + 0, x * 1, x & 0, x ^ x, ...
+    int common_subexpressions = 0;
+    int dead_nodes = 0;                 // Nodes no output depends on
+    int nodes_after = 0;
+};
+
 // Main mapper class - orchestrates the mapping process
 class doda_mapper {
 private:
@@ -170,37 +222,138 @@ private:
     
     // Data structures
     nlohmann::json dfg_json;
-    Mapper_DFG dfg;
-
-    // Helper methods for graph construction
-    void add_counter_node();
-    void add_loop_condition_nodes();
-    void add_load_node(const std::string& input_name);
-    void add_store_node(const std::string& output_name);
-    void add_terminal_node();
+    Mapper_DFG dfg;                             // Phase 0 when the graph is temporally partitioned
+    std::vector<Mapper_DFG> phase_dfgs;         // Every phase, in execution order (empty if the graph fits)
+    std::vector<PlacementReport> placement_reports;     // One per phase
+    OptimizationReport optimization_report;
+
+    // Helper methods for graph construction. Stream k (input k / output k) uses the SPM bank
+    // of cluster k; stream 0 keeps the single-stream layout. The loop nodes of a replica are
+    // named with its prefix (see replica_prefix). cluster == -1 places nodes in creation order.
+    void place_node(const std::string& id, Opcode op, int cluster,
+                    bool initial_output_used = false, int initial_output = -1);
+    void add_counter_node(const std::string& prefix = "", int cluster = -1);
+    void add_loop_condition_nodes(int loop_bound, const std::string& prefix = "", int cluster = -1);
+    // address_id is the node giving the SPM index (default: the counter)
+    void add_load_node(const std::string& load_id, int cluster = -1, const std::string& prefix = "",
+                       const std::string& address_id = "");
+    void add_store_node(const std::string& store_id, const std::string& output_name,
+                        int cluster = -1, const std::string& prefix = "", const std::string& address_id = "");
+    std::string add_store_join_nodes(const std::vector<std::string>& store_ids);   // Returns the node the terminal waits on
+    void add_reduction_nodes(const std::string& output_name, const nlohmann::json& reduction);
+    void add_terminal_node(const std::string& store_id);
+
+    // Replication: copy r > 0 of a single-stream map runs its own counter, loop conditions,
+    // LOAD, STORE and kernel nodes entirely in cluster r, on that cluster's SPM
+    int replica_count(size_t num_inputs, size_t num_outputs, bool is_reduction) const;
+    void add_replica(int replica, const std::string& input_name, const std::string& output_name, int loop_bound);
+    static std::string replica_prefix(int replica) { return "r" + std::to_string(replica) + "_"; }
+
+    // Copy of a JSON "nodes" array with every node id and node reference passed through rename
+    static nlohmann::json rename_nodes(const nlohmann::json& nodes,
+                                       const std::function<std::string(const std::string&)>& rename);
     
     // Initialization helpers
+    void initialize();                      // Builds the DFG from dfg_json
     void extract_vector_size();
+    void parse_streams(std::vector<std::string>& input_names, std::vector<std::string>& output_names) const;
     void construct_graph();
-    void resolve_input_pe_indices();        // Trace input nodes and add their PE indices
+    // Temporal partitioning of a graph larger than the fabric. Kernel nodes are split, in order,
+    // into phases that each fit the fabric; every phase runs the whole loop over the tile. A value
+    // read by a later phase is stored to an SPM slot ("spill_<id>") and loaded back under its own
+    // id. Slot j is row j / NUM_CLUSTER of cluster j % NUM_CLUSTER, slot k < #streams being
+    // stream k, and row r starts at r * tile, so the tile shrinks to SPM_ENTRIES / rows
+    // elements; the compiled loop bound is that tile length. Output k is stored over input k
+    // once no later phase reads input k, and a reduction runs in the last phase.
+    void construct_phases();
+    static void resolve_input_pe_indices(Mapper_DFG& target_dfg);  // Trace input nodes and add their PE indices
 
 public:
+    // A cut edge on a longest path costs as much as this many other cut edges
+    static constexpr int CRITICAL_EDGE_WEIGHT = 4;
+
+    // Nodes read by more than this many others are copied next to their consumers (split_fanout)
+    static constexpr int FANOUT_THRESHOLD = 2;
+
+    static constexpr int MAX_STREAMS = doda_mapper_utils::BitstreamConstants::NUM_CLUSTER;
+
+    // Node IDs of the generated STORE nodes
+    static std::string store_node_id(int stream) {
+        return stream == 0 ? "store_output" : "store_output_" + std::to_string(stream);
+    }
+
     explicit doda_mapper(const std::string& dfg_path);
+    // In-memory DFG; input_size_bytes >= 0 overrides the JSON runtime_metadata
+    doda_mapper(const nlohmann::json& dfg, int input_size_bytes);
+    // Maps a chain of kernels as one DFG (see fuse_dfgs)
+    doda_mapper(const std::vector<nlohmann::json>& stages, int input_size_bytes);
     
     // Getters
     const Mapper_DFG& get_dfg() const { return dfg; }
+    const PlacementReport& get_placement_report(size_t phase = 0) const { return placement_reports.at(phase); }
+    const OptimizationReport& get_optimization_report() const { return optimization_report; }
+
+    // Temporal partitioning: a graph that needs more PEs than the fabric has is split into
+    // phases that run one after another over the same tile (see construct_phases). Phase 0 is
+    // also get_dfg(); a graph that fits has a single phase.
+    size_t num_phases() const { return phase_dfgs.empty() ? 1 : phase_dfgs.size(); }
+    const Mapper_DFG& get_phase_dfg(size_t phase) const { return phase_dfgs.empty() ? dfg : phase_dfgs.at(phase); }
     int get_input_size_bytes() const { return input_size_byte; }
     int get_input_size_elements() const { return input_size_element; }
     
     // Utility
     void print_debug_info() const;
 
-    // Convert JSON nodes to DFG nodes
-    static void convert_json_to_dfg(const nlohmann::json& json, Mapper_DFG& target_dfg);
+    // Convert JSON nodes to DFG nodes (cluster >= 0 places them all in that cluster)
+    static void convert_json_to_dfg(const nlohmann::json& json, Mapper_DFG& target_dfg, int cluster = -1);
+
+    // Splice the DFGs of chained single-input, single-output kernels into one DFG: the output
+    // node of stage i drives the nodes that read the input of stage i+1, so intermediate values
+    // never go through a STORE/LOAD. Nodes of stage i are renamed "s<i>_<id>". Only the last
+    // stage may be a reduction.
+    static nlohmann::json fuse_dfgs(const std::vector<nlohmann::json>& stages);
+
+    // Optimization pipeline on the kernel nodes of a DFG JSON, run before the graph is built so
+    // that replication and temporal partitioning see the smaller kernel. Constant folding (with
+    // reassociation of constant chains: (x + 1) + 1 becomes x + 2), algebraic identities, common
+    // subexpression elimination and dead-node elimination repeat until none removes a node.
+    // Values wrap at 32 bits; RS and the ordered comparisons, whose signedness the JSON does not
+    // fix, are only simplified when that does not matter. Output nodes are never removed. Skipped
+    // with "runtime_metadata": {"optimize": false}.
+    static OptimizationReport optimize_kernel(nlohmann::json& kernel);
+
+    // Tree-height reduction: a tree of ADD, MUL, AND, OR or XOR nodes whose inner values are read
+    // only by the next node of the tree (a linear chain, as a+b+c+d compiles to) is rewired as a
+    // balanced tree, combining the two earliest-ready operands first. The tree keeps its nodes, so
+    // no PE is added; the root keeps its id and consumers. Results wrap at 32 bits like the PEs.
+    // Returns the number of trees rewired.
+    static int balance_trees(Mapper_DFG& target_dfg);
+
+    // Placement: reassign PE indices so that producer-consumer edges stay inside a cluster.
+    // Starting from creation order, nodes are moved or swapped between clusters while that
+    // lowers the weighted cut (edges on a longest path weigh CRITICAL_EDGE_WEIGHT), keeping at
+    // most PES_PER_CLUSTER nodes per cluster. LOAD/STORE nodes and nodes added with
+    // add_node_in_cluster stay in their cluster, and nodes that do not move keep their PE.
+    // Must run before PE indices are resolved.
+    static PlacementReport place_nodes(Mapper_DFG& target_dfg);
+
+    // Fanout splitting, after placement: a node read by more than FANOUT_THRESHOLD others is copied
+    // into each other cluster holding some of its consumers, onto a free PE, and those consumers
+    // read the copy. A copy must find all its inputs in its cluster, so the counter (a self-loop
+    // with the same initial output) is copied first and the continue conditions then read the
+    // local counter. Keeps cross-cluster broadcasts out of the loop. Returns the number of copies.
+    static int split_fanout(Mapper_DFG& target_dfg);
 
     // Generate bitstream for DODA
     static std::string node_to_bitstream(const Mapper_Node& node);
     static std::vector<std::vector<std::string>> generate_bitstream(const Mapper_DFG& target_dfg);
+
+    // Generate packed bitstream words (4 per PE, cluster-major, bit 0 = LSB of word 0; the
+    // PackedBitstream payload layout) without building strings. Returns the number of words
+    // required; words are only written if capacity_words is large enough.
+    static constexpr int WORDS_PER_INSTRUCTION = 4;
+    static void node_to_words(const Mapper_Node& node, uint32_t* words);
+    static size_t generate_packed_bitstream(const Mapper_DFG& target_dfg, uint32_t* words, size_t capacity_words);
 };
 
 // Implementation of stream operators
@@ -248,22 +401,58 @@ inline std::ostream& operator<<(std::ostream& os, const Mapper_DFG& dfg) {
 
 
 // Constructor
-doda_mapper::doda_mapper(const std::string& dfg_path)
+inline doda_mapper::doda_mapper(const std::string& dfg_path)
     : input_dfg_path(dfg_path), input_size_byte(0), input_size_element(0) {
 
-    Mapper_Node::reset_node_counter(); // Reset node counter for a fresh start
     dfg_json = doda_mapper_utils::load_and_parse_json(input_dfg_path);
+    initialize();
+}
+
+inline doda_mapper::doda_mapper(const nlohmann::json& dfg, int input_size_bytes)
+    : input_dfg_path(""), input_size_byte(0), input_size_element(0), dfg_json(dfg) {
+
+    if (input_size_bytes >= 0) {
+        dfg_json["runtime_metadata"]["input_size_in_bytes"] = input_size_bytes;
+    }
+    initialize();
+}
 
+inline doda_mapper::doda_mapper(const std::vector<nlohmann::json>& stages, int input_size_bytes)
+    : doda_mapper(fuse_dfgs(stages), input_size_bytes) {
+}
+
+inline void doda_mapper::initialize() {
     extract_vector_size();
+    if (!dfg_json.contains("runtime_metadata") || dfg_json["runtime_metadata"].value("optimize", true)) {
+        optimization_report = optimize_kernel(dfg_json);
+    }
     construct_graph();
-    resolve_input_pe_indices();
+    if (dfg.size() > static_cast<size_t>(doda_mapper_utils::BitstreamConstants::NUM_CLUSTER *
+                                         doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER)) {
+        construct_phases();
+    }
+
+    if (phase_dfgs.empty()) {
+        balance_trees(dfg);
+        placement_reports.push_back(place_nodes(dfg));
+        split_fanout(dfg);
+        resolve_input_pe_indices(dfg);
+    } else {
+        for (Mapper_DFG& phase_dfg : phase_dfgs) {
+            balance_trees(phase_dfg);
+            placement_reports.push_back(place_nodes(phase_dfg));
+            split_fanout(phase_dfg);
+            resolve_input_pe_indices(phase_dfg);
+        }
+        dfg = phase_dfgs[0];
+    }
 
 #ifdef DEBUG
     print_debug_info();
 #endif
 }
 
-void doda_mapper::extract_vector_size() {
+inline void doda_mapper::extract_vector_size() {
     if (dfg_json.contains("runtime_metadata") && 
         dfg_json["runtime_metadata"].contains("input_size_in_bytes")) {
         input_size_byte = dfg_json["runtime_metadata"]["input_size_in_bytes"];
@@ -279,49 +468,854 @@ void doda_mapper::extract_vector_size() {
     }
 }
 
-void doda_mapper::construct_graph() {
-    // Add basic infrastructure nodes
-    add_counter_node();
-    add_loop_condition_nodes();
-    // Add output node
-    if (dfg_json.contains("output") && dfg_json["output"].contains("id")) {
-        std::string output_name = dfg_json["output"]["id"].get<std::string>();
-        add_store_node(output_name);
+inline void doda_mapper::parse_streams(std::vector<std::string>& input_names, std::vector<std::string>& output_names) const {
+    // Outputs: "outputs": [{"id": ...}, ...] or a single "output": {"id": ...}
+    if (dfg_json.contains("outputs") && dfg_json["outputs"].is_array()) {
+        for (const auto& output : dfg_json["outputs"]) {
+            output_names.push_back(output["id"].get<std::string>());
+        }
+    } else if (dfg_json.contains("output") && dfg_json["output"].contains("id")) {
+        output_names.push_back(dfg_json["output"]["id"].get<std::string>());
     } else {
         throw std::runtime_error("Missing or invalid output specification in JSON");
     }
+    if (output_names.empty() || output_names.size() > static_cast<size_t>(MAX_STREAMS)) {
+        std::cerr << "[doda_mapper] Error: " << output_names.size() << " outputs (1 to "
+                  << MAX_STREAMS << " supported)." << std::endl;
+        throw std::runtime_error("Invalid output count");
+    }
 
-    // Add termination node
-    add_terminal_node();
-
-    // Add the input node
+    // Inputs
     if (dfg_json.contains("inputs") && dfg_json["inputs"].is_array()) {
-        auto inputs_array = dfg_json["inputs"];
-        if (inputs_array.size() == 1) {
-            std::string input_name = inputs_array[0].get<std::string>();
-            add_load_node(input_name);
-        } else {
-            std::cerr << "[doda_mapper] Error: Input array size is not 1." << std::endl;
+        for (const auto& input : dfg_json["inputs"]) {
+            input_names.push_back(input.get<std::string>());
+        }
+        if (input_names.empty() || input_names.size() > static_cast<size_t>(MAX_STREAMS)) {
+            std::cerr << "[doda_mapper] Error: " << input_names.size() << " inputs (1 to "
+                      << MAX_STREAMS << " supported)." << std::endl;
             throw std::runtime_error("Invalid input array size");
         }
     } else {
         std::cerr << "[doda_mapper] Error: No valid 'inputs' array found in JSON." << std::endl;
         throw std::runtime_error("Missing or invalid 'inputs' array in JSON");
     }
+}
+
+inline void doda_mapper::construct_graph() {
+    std::vector<std::string> input_names, output_names;
+    parse_streams(input_names, output_names);
+
+    // A reduction kernel folds its single output into an accumulator and stores only the result
+    const bool is_reduction = dfg_json.contains("reduction");
+    if (is_reduction && output_names.size() != 1) {
+        throw std::runtime_error("A reduction kernel must have exactly one output");
+    }
+
+    // Each replica processes its own partition of the input
+    const int replicas = replica_count(input_names.size(), output_names.size(), is_reduction);
+    const int loop_bound = (input_size_element + replicas - 1) / replicas;
+
+    // Add basic infrastructure nodes
+    add_counter_node();
+    add_loop_condition_nodes(loop_bound);
+
+    // Add output nodes
+    std::string terminal_wait_id = store_node_id(0);
+    if (is_reduction) {
+        add_reduction_nodes(output_names[0], dfg_json["reduction"]);
+    } else {
+        std::vector<std::string> store_ids;
+        for (size_t m = 0; m < output_names.size(); m++) {
+            store_ids.push_back(store_node_id(static_cast<int>(m)));
+            add_store_node(store_ids.back(), output_names[m], m == 0 ? -1 : static_cast<int>(m));
+        }
+        for (int r = 1; r < replicas; r++) {
+            add_replica(r, input_names[0], output_names[0], loop_bound);
+            store_ids.push_back(replica_prefix(r) + store_node_id(0));
+        }
+        terminal_wait_id = add_store_join_nodes(store_ids);
+    }
+
+    // Add termination node
+    add_terminal_node(terminal_wait_id);
+
+    // Add the input nodes
+    for (size_t k = 0; k < input_names.size(); k++) {
+        add_load_node(input_names[k], k == 0 ? -1 : static_cast<int>(k));
+    }
 
     // Convert JSON nodes to DFG nodes and update the DFG
     convert_json_to_dfg(dfg_json, dfg);
 
-    // Register output relationship: output_node -> store_output
-    // (must be done after convert_json_to_dfg creates the output node)
-    if (dfg_json.contains("output") && dfg_json["output"].contains("id")) {
-        std::string output_name = dfg_json["output"]["id"].get<std::string>();
-        auto& output_node = dfg.get_node(output_name);
-        output_node.add_output("store_output");
+    // Register output relationships: output_node -> store (or accumulator)
+    // (must be done after convert_json_to_dfg creates the output nodes)
+    if (is_reduction) {
+        auto& output_node = dfg.get_node(output_names[0]);
+        output_node.add_output("accumulator");
+        if (dfg.has_node("accumulator_cmp")) {
+            output_node.add_output("accumulator_cmp");
+        }
+        return;
+    }
+    for (size_t m = 0; m < output_names.size(); m++) {
+        auto& output_node = dfg.get_node(output_names[m]);
+        output_node.add_output(store_node_id(static_cast<int>(m)));
+    }
+}
+
+inline void doda_mapper::construct_phases() {
+    const int num_clusters = doda_mapper_utils::BitstreamConstants::NUM_CLUSTER;
+    const int pes_per_cluster = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER;
+    const int fabric_pes = num_clusters * pes_per_cluster;
+
+    std::vector<std::string> input_names, output_names;
+    parse_streams(input_names, output_names);
+    const bool is_reduction = dfg_json.contains("reduction");
+    const std::string reduction_op = is_reduction ? dfg_json["reduction"].value("op", std::string()) : "";
+    const int reduction_pes = !is_reduction ? 0 : (reduction_op == "min" || reduction_op == "max") ? 3 : 2;
+
+    // Kernel nodes, in JSON (topological) order, and the values (kernel nodes or input streams)
+    // each one reads
+    const nlohmann::json& json_nodes = dfg_json["nodes"];
+    const int n = static_cast<int>(json_nodes.size());
+    std::vector<std::string> node_ids(n);
+    std::map<std::string, int> node_index;
+    std::vector<std::vector<std::string>> reads(n);
+    std::map<std::string, std::vector<int>> readers;
+    for (int v = 0; v < n; v++) {
+        node_ids[v] = json_nodes[v]["id"].get<std::string>();
+        node_index[node_ids[v]] = v;
+        if (!json_nodes[v].contains("inputs")) continue;
+        for (const auto& input : json_nodes[v]["inputs"]) {
+            if (!input.contains("id")) continue;
+            const std::string id = input["id"].get<std::string>();
+            if (std::find(reads[v].begin(), reads[v].end(), id) == reads[v].end()) {
+                reads[v].push_back(id);
+                readers[id].push_back(v);
+            }
+        }
+    }
+    const std::set<std::string> outputs(output_names.begin(), output_names.end());
+    auto producer_phase = [&](const std::vector<int>& phase_of, const std::string& id) {
+        auto it = node_index.find(id);
+        return it == node_index.end() ? -1 : phase_of[it->second];     // Input streams: -1
+    };
+
+    // Greedy split: a phase takes kernel nodes in order while its estimated PE count (loop nodes,
+    // terminal, kernel nodes, one LOAD per value read from the SPM, one STORE per value handed on,
+    // store joins) stays within capacity
+    auto partition = [&](int capacity) {
+        std::vector<int> phase_of(n, -1);
+        std::vector<int> members;
+        int phase = 0;
+        auto estimate = [&]() {
+            std::set<std::string> loads;
+            int stores = 0;
+            for (int v : members) {
+                for (const std::string& id : reads[v]) {
+                    if (producer_phase(phase_of, id) != phase) loads.insert(id);
+                }
+                bool handed_on = outputs.count(node_ids[v]) > 0;
+                auto it = readers.find(node_ids[v]);
+                if (it != readers.end()) {
+                    for (int r : it->second) handed_on = handed_on || phase_of[r] != phase;
+                }
+                stores += handed_on ? 1 : 0;
+            }
+            return 4 + static_cast<int>(members.size() + loads.size()) + stores + std::max(0, stores - 1);
+        };
+        for (int v = 0; v < n; v++) {
+            phase_of[v] = phase;
+            members.push_back(v);
+            if (estimate() <= capacity) continue;
+            if (members.size() > 1) {
+                members.assign(1, v);
+                phase_of[v] = ++phase;
+            }
+            if (estimate() > capacity) {
+                throw std::runtime_error("Node '" + node_ids[v] + "' does not fit in one configuration of the fabric");
+            }
+        }
+        return phase_of;
+    };
+
+    // The estimate leaves out spill addresses and the reduction, so an over-full split is retried
+    // with less room per phase
+    for (int capacity = fabric_pes; capacity > 8; capacity -= 4) {
+        const std::vector<int> phase_of = partition(capacity);
+        const int num_phases = n == 0 ? 1 : phase_of.back() + 1;
+
+        // Phases that read each value from the SPM
+        std::map<std::string, std::set<int>> load_phases;
+        for (int v = 0; v < n; v++) {
+            for (const std::string& id : reads[v]) {
+                if (producer_phase(phase_of, id) != phase_of[v]) load_phases[id].insert(phase_of[v]);
+            }
+        }
+
+        // Output k overwrites input k, so it is stored in the last phase that reads input k (or
+        // later); a reduction accumulates in the last phase
+        std::vector<int> final_phase(output_names.size());
+        for (size_t k = 0; k < output_names.size(); k++) {
+            int phase = is_reduction ? num_phases - 1 : std::max(0, producer_phase(phase_of, output_names[k]));
+            if (k < input_names.size() && load_phases.count(input_names[k])) {
+                phase = std::max(phase, *load_phases[input_names[k]].rbegin());
+            }
+            final_phase[k] = phase;
+            if (producer_phase(phase_of, output_names[k]) != phase) {
+                load_phases[output_names[k]].insert(phase);
+            }
+        }
+
+        // SPM slots: slot j is row j / num_clusters of cluster j % num_clusters. Stream k keeps slot
+        // k; a spilled value holds a slot from the phase that stores it to the last phase that
+        // loads it, and the slot is free again for stores in later phases
+        const int stream_slots = static_cast<int>(std::max(input_names.size(), output_names.size()));
+        std::map<std::string, int> slot;
+        for (size_t k = 0; k < input_names.size(); k++) {
+            slot[input_names[k]] = static_cast<int>(k);
+        }
+        std::vector<int> busy_until(stream_slots, num_phases);
+        for (int v = 0; v < n; v++) {
+            auto it = load_phases.find(node_ids[v]);
+            if (it == load_phases.end()) continue;
+            int j = stream_slots;
+            while (j < static_cast<int>(busy_until.size()) && busy_until[j] >= phase_of[v]) j++;
+            if (j == static_cast<int>(busy_until.size())) busy_until.push_back(0);
+            busy_until[j] = *it->second.rbegin();
+            slot[node_ids[v]] = j;
+        }
+        const int rows = (static_cast<int>(busy_until.size()) + num_clusters - 1) / num_clusters;
+        const int tile = doda_mapper_utils::BitstreamConstants::SPM_ENTRIES / rows;
+        const int stride = input_size_element > 0 ? std::min(input_size_element, tile) : tile;
+
+        // Exact PE count of every phase; LOAD/STOREs must fit next to their SPM
+        bool fits = true;
+        for (int p = 0; p < num_phases && fits; p++) {
+            const bool last = p == num_phases - 1;
+            int kernel = 0, accesses = 0, stores = 0;
+            std::set<int> rows_used;
+            std::vector<int> per_cluster(num_clusters, 0);
+            auto access = [&](int j) {
+                accesses++;
+                per_cluster[j % num_clusters]++;
+                if (j >= num_clusters) rows_used.insert(j / num_clusters);
+            };
+            for (const auto& [id, phases] : load_phases) {
+                if (phases.count(p)) access(slot.at(id));
+            }
+            for (int v = 0; v < n; v++) {
+                if (phase_of[v] != p) continue;
+                kernel++;
+                if (load_phases.count(node_ids[v])) {
+                    access(slot.at(node_ids[v]));
+                    stores++;
+                }
+            }
+            for (size_t k = 0; k < output_names.size(); k++) {
+                if (final_phase[k] == p && !is_reduction) {
+                    access(static_cast<int>(k));
+                    stores++;
+                }
+            }
+            const int reduction = is_reduction && last ? reduction_pes : 0;
+            const int pes = 4 + kernel + accesses + std::max(0, stores - 1) + static_cast<int>(rows_used.size()) + reduction;
+            // Loop nodes, reduction and spill addresses are created before the LOAD/STOREs, in cluster 0
+            per_cluster[0] += 3 + reduction + static_cast<int>(rows_used.size());
+            fits = pes <= fabric_pes && *std::max_element(per_cluster.begin(), per_cluster.end()) <= pes_per_cluster;
+        }
+        if (!fits) {
+            continue;
+        }
+
+        std::cout << "[construct_phases] " << n << " kernel nodes in " << num_phases << " phases, "
+                  << busy_until.size() - stream_slots << " spill slots, tiles of " << stride << " elements" << std::endl;
+
+        for (int p = 0; p < num_phases; p++) {
+            const bool last = p == num_phases - 1;
+            dfg = Mapper_DFG();
+            add_counter_node();
+            add_loop_condition_nodes(stride);
+            if (is_reduction && last) {
+                add_reduction_nodes(output_names[0], dfg_json["reduction"]);
+            }
+
+            // SPM index of a slot: the counter for row 0, else counter + row * stride
+            auto address = [&](int j) {
+                const int row = j / num_clusters;
+                if (row == 0) return std::string();
+                const std::string address_id = "spill_address_" + std::to_string(row);
+                if (!dfg.has_node(address_id)) {
+                    dfg.add_node(address_id, Opcode::ADD);
+                    auto& address_node = dfg.get_node(address_id);
+                    address_node.add_input("i1", "counter");
+                    dfg.get_node("counter").add_output(address_id);
+                    address_node.add_input("i2", row * stride);
+                }
+                return address_id;
+            };
+
+            // LOADs keep the id of the value they reload, so kernel nodes read them unchanged
+            std::vector<std::string> values(input_names);
+            values.insert(values.end(), node_ids.begin(), node_ids.end());
+            for (const std::string& id : values) {
+                auto it = load_phases.find(id);
+                if (it != load_phases.end() && it->second.count(p)) {
+                    const int j = slot.at(id);
+                    const std::string address_id = address(j);
+                    add_load_node(id, j % num_clusters, "", address_id);
+                }
+            }
+
+            std::vector<std::string> store_ids;
+            std::vector<std::pair<std::string, std::string>> stored;     // (value, STORE node)
+            for (int v = 0; v < n; v++) {
+                if (phase_of[v] != p || !load_phases.count(node_ids[v])) continue;
+                const int j = slot.at(node_ids[v]);
+                const std::string address_id = address(j);
+                store_ids.push_back("spill_" + node_ids[v]);
+                add_store_node(store_ids.back(), node_ids[v], j % num_clusters, "", address_id);
+                stored.emplace_back(node_ids[v], store_ids.back());
+            }
+            for (size_t k = 0; k < output_names.size(); k++) {
+                if (final_phase[k] != p || is_reduction) continue;
+                store_ids.push_back(store_node_id(static_cast<int>(k)));
+                add_store_node(store_ids.back(), output_names[k], static_cast<int>(k));
+                stored.emplace_back(output_names[k], store_ids.back());
+            }
+
+            nlohmann::json phase_json;
+            phase_json["nodes"] = nlohmann::json::array();
+            for (int v = 0; v < n; v++) {
+                if (phase_of[v] == p) phase_json["nodes"].push_back(json_nodes[v]);
+            }
+            convert_json_to_dfg(phase_json, dfg);
+
+            // Register the stored values (and the reduced one) as producers
+            for (const auto& [value, store_id] : stored) {
+                dfg.get_node(value).add_output(store_id);
+            }
+            if (is_reduction && last) {
+                auto& output_node = dfg.get_node(output_names[0]);
+                output_node.add_output("accumulator");
+                if (dfg.has_node("accumulator_cmp")) {
+                    output_node.add_output("accumulator_cmp");
+                }
+                add_terminal_node(store_node_id(0));
+            } else {
+                if (store_ids.empty()) {
+                    throw std::runtime_error("Phase " + std::to_string(p) + " stores no values");
+                }
+                add_terminal_node(add_store_join_nodes(store_ids));
+            }
+            phase_dfgs.push_back(std::move(dfg));
+        }
+        return;
+    }
+    throw std::runtime_error("The DFG cannot be split into configurations of the fabric");
+}
+
+inline int doda_mapper::replica_count(size_t num_inputs, size_t num_outputs, bool is_reduction) const {
+    // "runtime_metadata": {"replicas": R} requests up to R copies of a single-stream map
+    int requested = 1;
+    if (dfg_json.contains("runtime_metadata") && dfg_json["runtime_metadata"].contains("replicas")) {
+        requested = dfg_json["runtime_metadata"]["replicas"].get<int>();
+    }
+    if (requested <= 1 || num_inputs != 1 || num_outputs != 1 || is_reduction) {
+        return 1;
+    }
+    requested = std::min(requested, doda_mapper_utils::BitstreamConstants::NUM_CLUSTER);
+
+    // A copy needs counter, two loop conditions, LOAD, STORE and the kernel nodes; copy 0 also
+    // holds the terminal and one store join per further copy, and must fit in cluster 0
+    const int kernel_nodes = dfg_json.contains("nodes") ? static_cast<int>(dfg_json["nodes"].size()) : 0;
+    const int pes_per_copy = 5 + kernel_nodes;
+    const int fit = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER - pes_per_copy;
+    return std::max(1, std::min(requested, fit));
+}
+
+inline void doda_mapper::add_replica(int replica, const std::string& input_name, const std::string& output_name,
+                              int loop_bound) {
+    const std::string prefix = replica_prefix(replica);
+    add_counter_node(prefix, replica);
+    add_loop_condition_nodes(loop_bound, prefix, replica);
+    add_store_node(prefix + store_node_id(0), prefix + output_name, replica, prefix);
+    add_load_node(prefix + input_name, replica, prefix);
+
+    nlohmann::json replica_json;
+    replica_json["nodes"] = rename_nodes(dfg_json["nodes"], [&](const std::string& id) { return prefix + id; });
+    convert_json_to_dfg(replica_json, dfg, replica);
+    dfg.get_node(prefix + output_name).add_output(prefix + store_node_id(0));
+}
+
+inline nlohmann::json doda_mapper::rename_nodes(const nlohmann::json& nodes,
+                                         const std::function<std::string(const std::string&)>& rename) {
+    nlohmann::json renamed = nlohmann::json::array();
+    for (nlohmann::json node : nodes) {
+        node["id"] = rename(node["id"].get<std::string>());
+        if (node.contains("inputs") && node["inputs"].is_array()) {
+            for (auto& input : node["inputs"]) {
+                if (input.contains("id")) {
+                    input["id"] = rename(input["id"].get<std::string>());
+                }
+            }
+        }
+        renamed.push_back(node);
+    }
+    return renamed;
+}
+
+inline nlohmann::json doda_mapper::fuse_dfgs(const std::vector<nlohmann::json>& stages) {
+    if (stages.empty()) {
+        throw std::runtime_error("No DFGs to fuse");
+    }
+
+    nlohmann::json fused;
+    fused["nodes"] = nlohmann::json::array();
+    std::string upstream_output;    // Fused id of the previous stage's output
+
+    for (size_t s = 0; s < stages.size(); s++) {
+        const nlohmann::json& stage = stages[s];
+        if (!stage.contains("inputs") || !stage["inputs"].is_array() || stage["inputs"].size() != 1 ||
+            !stage.contains("output") || !stage["output"].contains("id")) {
+            throw std::runtime_error("Stage " + std::to_string(s) + " is not a single-input, single-output DFG");
+        }
+        if (stage.contains("reduction") && s + 1 != stages.size()) {
+            throw std::runtime_error("Only the last fused stage may be a reduction");
+        }
+
+        const std::string prefix = "s" + std::to_string(s) + "_";
+        const std::string input_name = stage["inputs"][0].get<std::string>();
+        auto rename = [&](const std::string& id) {
+            if (id == input_name) {
+                return s == 0 ? id : upstream_output;   // Stage 0 keeps its LOAD
+            }
+            return prefix + id;
+        };
+
+        if (stage.contains("nodes") && stage["nodes"].is_array()) {
+            for (const auto& node : rename_nodes(stage["nodes"], rename)) {
+                fused["nodes"].push_back(node);
+            }
+        }
+        upstream_output = rename(stage["output"]["id"].get<std::string>());
+
+        if (s == 0) {
+            fused["inputs"] = stage["inputs"];
+            if (stage.contains("runtime_metadata")) {
+                fused["runtime_metadata"] = stage["runtime_metadata"];
+            }
+        }
+        if (stage.contains("reduction")) {
+            fused["reduction"] = stage["reduction"];
+        }
     }
+    fused["output"]["id"] = upstream_output;
+    return fused;
 }
 
-void doda_mapper::convert_json_to_dfg(const nlohmann::json& json, Mapper_DFG& target_dfg) {
+inline OptimizationReport doda_mapper::optimize_kernel(nlohmann::json& kernel) {
+    OptimizationReport report;
+    if (!kernel.contains("nodes") || !kernel["nodes"].is_array()) {
+        return report;
+    }
+
+    std::set<std::string> outputs;
+    if (kernel.contains("outputs") && kernel["outputs"].is_array()) {
+        for (const auto& output : kernel["outputs"]) outputs.insert(output["id"].get<std::string>());
+    } else if (kernel.contains("output") && kernel["output"].contains("id")) {
+        outputs.insert(kernel["output"]["id"].get<std::string>());
+    }
+
+    // An operand reads a node (or input stream) by id, or is a constant when id is empty
+    struct Operand {
+        std::string type;
+        std::string id;
+        uint32_t value = 0;
+        bool is_const() const { return id.empty(); }
+        bool operator==(const Operand& other) const {
+            return id == other.id && (!is_const() || value == other.value);
+        }
+    };
+    struct Node {
+        nlohmann::json json;        // Keeps any fields besides "op" and "inputs"
+        std::string id;
+        Opcode op;
+        std::vector<Operand> inputs;
+        bool removed = false;
+    };
+
+    std::vector<Node> original;
+    for (const auto& json_node : kernel["nodes"]) {
+        Node node;
+        node.json = json_node;
+        node.id = json_node["id"].get<std::string>();
+        node.op = toOpcode(json_node["op"].get<std::string>());
+        if (json_node.contains("inputs") && json_node["inputs"].is_array()) {
+            for (const auto& input : json_node["inputs"]) {
+                Operand operand;
+                operand.type = input["type"].get<std::string>();
+                if (input.contains("id")) {
+                    operand.id = input["id"].get<std::string>();
+                } else {
+                    operand.value = static_cast<uint32_t>(input["value"].get<int>());
+                }
+                node.inputs.push_back(operand);
+            }
+        }
+        original.push_back(node);
+    }
+    report.nodes_before = static_cast<int>(original.size());
+
+    auto is_commutative = [](Opcode op) {
+        return op == Opcode::ADD || op == Opcode::MUL || op == Opcode::AND || op == Opcode::OR ||
+               op == Opcode::XOR || op == Opcode::CMP || op == Opcode::CNE;
+    };
+    auto is_pure = [](Opcode op) {
+        return op != Opcode::LOAD && op != Opcode::STORE && op != Opcode::JUMP && op != Opcode::NIL &&
+               op != Opcode::UNSUPPORTED;
+    };
+    auto find_input = [](Node& node, const char* type) -> Operand* {
+        for (auto& input : node.inputs) {
+            if (input.type == type) return &input;
+        }
+        return nullptr;
+    };
+    auto evaluate = [](Opcode op, uint32_t a, uint32_t b, uint32_t& result) {
+        switch (op) {
+            case Opcode::ADD: result = a + b; return true;
+            case Opcode::SUB: result = a - b; return true;
+            case Opcode::MUL: result = a * b; return true;
+            case Opcode::AND: result = a & b; return true;
+            case Opcode::OR:  result = a | b; return true;
+            case Opcode::XOR: result = a ^ b; return true;
+            case Opcode::LS:
+                if (b >= 32) return false;
+                result = a << b;
+                return true;
+            case Opcode::CMP: result = a == b; return true;
+            case Opcode::CNE: result = a != b; return true;
+            default: return false;
+        }
+    };
+    auto make_const = [](const std::string& type, uint32_t value) {
+        Operand operand;
+        operand.type = type;
+        operand.value = value;
+        return operand;
+    };
+
+    // Runs the passes to a fixed point. Frozen nodes are left exactly as they are.
+    auto run = [&](const std::set<std::string>& frozen, OptimizationReport& counts) {
+        std::vector<Node> nodes = original;
+        auto removable = [&](const Node& node) {
+            return !node.removed && !frozen.count(node.id) && !outputs.count(node.id) && is_pure(node.op);
+        };
+        // Every read of id now reads the given operand (keeping the port type). A predicate is
+        // always a PE source: a constant true one is dropped, any other keeps reading id, in which
+        // case false is returned and the node must stay
+        auto substitute = [&](const std::string& id, const Operand& with) {
+            bool replaced = true;
+            for (auto& node : nodes) {
+                if (node.removed) continue;
+                for (auto input = node.inputs.begin(); input != node.inputs.end();) {
+                    if (input->is_const() || input->id != id) {
+                        ++input;
+                    } else if (input->type == "pred" && with.is_const()) {
+                        if (with.value != 0 && node.op != Opcode::SELECT) {
+                            input = node.inputs.erase(input);
+                        } else {
+                            replaced = false;
+                            ++input;
+                        }
+                    } else {
+                        input->id = with.id;
+                        input->value = with.value;
+                        ++input;
+                    }
+                }
+            }
+            return replaced;
+        };
+        auto use_count = [&](const std::string& id) {
+            int uses = 0;
+            for (const auto& node : nodes) {
+                if (node.removed) continue;
+                for (const auto& input : node.inputs) uses += !input.is_const() && input.id == id;
+            }
+            return uses;
+        };
+        std::map<std::string, size_t> index;
+        for (size_t i = 0; i < nodes.size(); i++) index[nodes[i].id] = i;
+
+        auto fold_constants = [&]() {
+            int removed = 0;
+            for (auto& node : nodes) {
+                if (node.removed || frozen.count(node.id)) continue;
+                Operand* a = find_input(node, "i1");
+                Operand* b = find_input(node, "i2");
+                if (!a || !b || find_input(node, "pred")) continue;
+
+                uint32_t result;
+                if (a->is_const() && b->is_const()) {
+                    if (removable(node) && evaluate(node.op, a->value, b->value, result) &&
+                        substitute(node.id, make_const("", result))) {
+                        node.removed = true;
+                        removed++;
+                    }
+                    continue;
+                }
+
+                // Reassociation: op(op(x, c1), c2) = op(x, c1 op c2), with x - c read as x + (-c)
+                auto as_chain = [&](Node& n, Opcode& op, Operand*& x, uint32_t& c) {
+                    Operand* p = find_input(n, "i1");
+                    Operand* q = find_input(n, "i2");
+                    if (!p || !q || find_input(n, "pred") || p->is_const() == q->is_const()) return false;
+                    op = n.op;
+                    if (op == Opcode::SUB) {
+                        if (!q->is_const()) return false;
+                        op = Opcode::ADD;
+                        x = p;
+                        c = 0u - q->value;
+                        return true;
+                    }
+                    if (op != Opcode::ADD && op != Opcode::MUL && op != Opcode::AND && op != Opcode::OR &&
+                        op != Opcode::XOR) {
+                        return false;
+                    }
+                    x = p->is_const() ? q : p;
+                    c = p->is_const() ? p->value : q->value;
+                    return true;
+                };
+                Opcode op, inner_op;
+                Operand *x, *y;
+                uint32_t c2, c1;
+                if (!as_chain(node, op, y, c2)) continue;
+                auto it = index.find(y->id);
+                if (it == index.end()) continue;
+                Node& inner = nodes[it->second];
+                if (inner.removed || frozen.count(inner.id) || !as_chain(inner, inner_op, x, c1) || inner_op != op) continue;
+
+                uint32_t c = 0;
+                if (!evaluate(op, c1, c2, c)) continue;
+                Operand operand = *x;
+                operand.type = "i1";
+                if (node.op == Opcode::SUB) node.json["op"] = "add";
+                node.op = op;
+                node.inputs = {operand, make_const("i2", c)};
+                if (removable(inner) && use_count(inner.id) == 0) {
+                    inner.removed = true;
+                    removed++;
+                }
+            }
+            return removed;
+        };
+
+        auto simplify_identities = [&]() {
+            int removed = 0;
+            for (auto& node : nodes) {
+                if (!removable(node)) continue;
+                Operand* a = find_input(node, "i1");
+                Operand* b = find_input(node, "i2");
+                Operand* pred = find_input(node, "pred");
+                if (!a || !b) continue;
+                auto is = [](const Operand* operand, uint32_t value) { return operand->is_const() && operand->value == value; };
+                const bool same = *a == *b;
+
+                const Operand* alias = nullptr;
+                bool constant = false;
+                uint32_t value = 0;
+                if (node.op == Opcode::SELECT) {
+                    if (pred && pred->is_const()) alias = pred->value ? a : b;
+                    else if (same) alias = a;
+                } else if (pred) {
+                    continue;
+                } else switch (node.op) {
+                    case Opcode::ADD:
+                        if (is(b, 0)) alias = a;
+                        else if (is(a, 0)) alias = b;
+                        break;
+                    case Opcode::SUB:
+                        if (is(b, 0)) alias = a;
+                        else if (same) constant = true;
+                        break;
+                    case Opcode::MUL:
+                        if (is(a, 0) || is(b, 0)) constant = true;
+                        else if (is(b, 1)) alias = a;
+                        else if (is(a, 1)) alias = b;
+                        break;
+                    case Opcode::AND:
+                        if (is(a, 0) || is(b, 0)) constant = true;
+                        else if (is(b, ~0u) || same) alias = a;
+                        else if (is(a, ~0u)) alias = b;
+                        break;
+                    case Opcode::OR:
+                        if (is(a, ~0u) || is(b, ~0u)) constant = true, value = ~0u;
+                        else if (is(b, 0) || same) alias = a;
+                        else if (is(a, 0)) alias = b;
+                        break;
+                    case Opcode::XOR:
+                        if (is(b, 0)) alias = a;
+                        else if (is(a, 0)) alias = b;
+                        else if (same) constant = true;
+                        break;
+                    case Opcode::LS:
+                    case Opcode::RS:
+                        if (is(b, 0)) alias = a;
+                        break;
+                    case Opcode::CMP:
+                    case Opcode::CLTE:
+                    case Opcode::CGTE:
+                        if (same) constant = true, value = 1;
+                        break;
+                    case Opcode::CNE:
+                    case Opcode::CLT:
+                    case Opcode::CGT:
+                        if (same) constant = true;
+                        break;
+                    default:
+                        break;
+                }
+                if (!alias && !constant) continue;
+                if (!substitute(node.id, alias ? *alias : make_const("", value))) continue;
+                node.removed = true;
+                removed++;
+            }
+            return removed;
+        };
+
+        auto eliminate_common_subexpressions = [&]() {
+            int removed = 0;
+            std::map<std::string, std::string> seen;   // Operation key -> first node computing it
+            for (auto& node : nodes) {
+                if (node.removed || !is_pure(node.op)) continue;
+                std::vector<std::string> operands;
+                for (const auto& input : node.inputs) {
+                    const std::string operand = input.is_const() ? "#" + std::to_string(input.value) : "@" + input.id;
+                    const bool data = input.type == "i1" || input.type == "i2";
+                    operands.push_back((data && is_commutative(node.op) ? std::string("i") : input.type) + operand);
+                }
+                std::sort(operands.begin(), operands.end());
+                std::string key = std::to_string(static_cast<int>(node.op));
+                for (const auto& operand : operands) key += " " + operand;
+
+                auto it = seen.find(key);
+                if (it == seen.end()) {
+                    seen.emplace(key, node.id);
+                } else if (removable(node)) {
+                    Operand operand;
+                    operand.id = it->second;
+                    substitute(node.id, operand);
+                    node.removed = true;
+                    removed++;
+                }
+            }
+            return removed;
+        };
+
+        auto eliminate_dead_nodes = [&]() {
+            int removed = 0;
+            std::set<std::string> live(outputs.begin(), outputs.end());
+            for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+                if (it->removed) continue;
+                if (!live.count(it->id) && removable(*it)) {
+                    it->removed = true;
+                    removed++;
+                    continue;
+                }
+                for (const auto& input : it->inputs) {
+                    if (!input.is_const()) live.insert(input.id);
+                }
+            }
+            return removed;
+        };
+
+        while (true) {
+            const int folded = fold_constants();
+            const int simplified = simplify_identities();
+            const int merged = eliminate_common_subexpressions();
+            const int dead = eliminate_dead_nodes();
+            counts.constant_folding += folded;
+            counts.algebraic_identities += simplified;
+            counts.common_subexpressions += merged;
+            counts.dead_nodes += dead;
+            if (folded + simplified + merged + dead == 0) break;
+        }
+        return nodes;
+    };
+
+    // A node whose operands all folded to constants would no longer fire once per element; such
+    // nodes keep their original definition, back to the input streams
+    auto reads_node = [](const Node& node) {
+        return std::any_of(node.inputs.begin(), node.inputs.end(), [](const Operand& input) { return !input.is_const(); });
+    };
+    std::set<std::string> frozen;
+    std::vector<Node> nodes;
+    OptimizationReport counts;
+    while (true) {
+        counts = report;
+        nodes = run(frozen, counts);
+        std::vector<std::string> pending;
+        for (const auto& node : nodes) {
+            if (!node.removed && !frozen.count(node.id) && !reads_node(node)) pending.push_back(node.id);
+        }
+        std::map<std::string, const Node*> by_id;
+        for (const auto& node : original) by_id[node.id] = &node;
+        const size_t num_frozen = frozen.size();
+        while (!pending.empty()) {
+            const std::string id = pending.back();
+            pending.pop_back();
+            auto it = by_id.find(id);
+            if (it == by_id.end() || !frozen.insert(id).second) continue;
+            for (const auto& input : it->second->inputs) {
+                if (!input.is_const()) pending.push_back(input.id);
+            }
+        }
+        if (frozen.size() == num_frozen) break;
+    }
+    report = counts;
+
+    for (const auto& node : nodes) {
+        if (node.removed || frozen.count(node.id)) continue;
+        const bool constant_pred = std::any_of(node.inputs.begin(), node.inputs.end(), [](const Operand& input) {
+            return input.type == "pred" && input.is_const();
+        });
+        if (constant_pred || !reads_node(node)) {
+            throw std::logic_error("optimize_kernel: node '" + node.id + "' was left without a " +
+                                   (constant_pred ? "predicate source" : "node input"));
+        }
+    }
+
+    nlohmann::json optimized = nlohmann::json::array();
+    for (auto& node : nodes) {
+        if (node.removed) continue;
+        if (!frozen.count(node.id)) {
+            nlohmann::json inputs = nlohmann::json::array();
+            for (const auto& input : node.inputs) {
+                nlohmann::json json_input;
+                json_input["type"] = input.type;
+                if (input.is_const()) {
+                    json_input["value"] = static_cast<int32_t>(input.value);
+                } else {
+                    json_input["id"] = input.id;
+                }
+                inputs.push_back(json_input);
+            }
+            node.json["inputs"] = inputs;
+        }
+        optimized.push_back(node.json);
+    }
+    kernel["nodes"] = optimized;
+    report.nodes_after = static_cast<int>(optimized.size());
+
+    std::cout << "[optimize_kernel] Kernel nodes: " << report.nodes_before << " -> " << report.nodes_after
+              << " (constant folding -" << report.constant_folding << ", algebraic identities -"
+              << report.algebraic_identities << ", common subexpressions -" << report.common_subexpressions
+              << ", dead nodes -" << report.dead_nodes << ")" << std::endl;
+    return report;
+}
+
+inline void doda_mapper::convert_json_to_dfg(const nlohmann::json& json, Mapper_DFG& target_dfg, int cluster) {
     if (json.contains("nodes") && json["nodes"].is_array()) {
         std::cout << "[convert_json_to_dfg] Adding nodes from JSON..." << std::endl;
         for (const auto& json_node : json["nodes"]) {
@@ -333,7 +1327,11 @@ void doda_mapper::convert_json_to_dfg(const nlohmann::json& json, Mapper_DFG& ta
                 Opcode op = toOpcode(opcode_str);
 
                 // Add the node to the DFG
-                target_dfg.add_node(node_id, op);
+                if (cluster < 0) {
+                    target_dfg.add_node(node_id, op);
+                } else {
+                    target_dfg.add_node_in_cluster(node_id, op, cluster);
+                }
                 auto& node = target_dfg.get_node(node_id);
 
                 std::cout << "[convert_json_to_dfg] Adding node: " << node_id
@@ -368,82 +1366,767 @@ void doda_mapper::convert_json_to_dfg(const nlohmann::json& json, Mapper_DFG& ta
     }
 }
 
-void doda_mapper::add_counter_node() {
-    dfg.add_node("counter", Opcode::ADD, true, 0);     // Initial output is 0
-    auto& counter_node = dfg.get_node("counter");
+inline void doda_mapper::place_node(const std::string& id, Opcode op, int cluster,
+                             bool initial_output_used, int initial_output) {
+    if (cluster < 0) {
+        dfg.add_node(id, op, initial_output_used, initial_output);
+    } else {
+        dfg.add_node_in_cluster(id, op, cluster, initial_output_used, initial_output);
+    }
+}
 
-    counter_node.add_input("i1", "counter");           // Self-reference from the initial output 0
-    counter_node.add_output("counter");                // Self-reference output
+inline void doda_mapper::add_counter_node(const std::string& prefix, int cluster) {
+    const std::string counter_id = prefix + "counter";
+    place_node(counter_id, Opcode::ADD, cluster, true, 0);     // Initial output is 0
+    auto& counter_node = dfg.get_node(counter_id);
+
+    counter_node.add_input("i1", counter_id);          // Self-reference from the initial output 0
+    counter_node.add_output(counter_id);               // Self-reference output
     counter_node.add_input("i2", 1);                   // Constant increment of 1
 }
 
-void doda_mapper::add_loop_condition_nodes() {
-    auto& counter_node = dfg.get_node("counter");
-
-    // Continue condition: counter < input_size_element
-    dfg.add_node("continue_condition", Opcode::CLT);
-    auto& continue_node = dfg.get_node("continue_condition");
-    continue_node.add_input("i1", "counter");
-    counter_node.add_output("continue_condition");
-    continue_node.add_input("i2", input_size_element);
+inline void doda_mapper::add_loop_condition_nodes(int loop_bound, const std::string& prefix, int cluster) {
+    const std::string counter_id = prefix + "counter";
+    const std::string continue_id = prefix + "continue_condition";
+    const std::string terminal_cond_id = prefix + "terminal_condition";
+    auto& counter_node = dfg.get_node(counter_id);
+
+    // Continue condition: counter < loop_bound
+    place_node(continue_id, Opcode::CLT, cluster);
+    auto& continue_node = dfg.get_node(continue_id);
+    continue_node.add_input("i1", counter_id);
+    counter_node.add_output(continue_id);
+    continue_node.add_input("i2", loop_bound);
+
+    // Terminal condition: counter >= loop_bound
+    place_node(terminal_cond_id, Opcode::CGTE, cluster);
+    auto& terminal_cond_node = dfg.get_node(terminal_cond_id);
+    terminal_cond_node.add_input("i1", counter_id);
+    counter_node.add_output(terminal_cond_id);
+    terminal_cond_node.add_input("i2", loop_bound);
+}
 
-    // Terminal condition: counter >= input_size_element
-    dfg.add_node("terminal_condition", Opcode::CGTE);
-    auto& terminal_cond_node = dfg.get_node("terminal_condition");
-    terminal_cond_node.add_input("i1", "counter");
-    counter_node.add_output("terminal_condition");
-    terminal_cond_node.add_input("i2", input_size_element);
+inline void doda_mapper::add_load_node(const std::string& load_id, int cluster, const std::string& prefix,
+                                const std::string& address_id) {
+    const std::string index_id = address_id.empty() ? prefix + "counter" : address_id;
+    const std::string continue_id = prefix + "continue_condition";
+    place_node(load_id, Opcode::LOAD, cluster);         // Reads the SPM of its cluster
+    auto& load_node = dfg.get_node(load_id);
+    auto& index_node = dfg.get_node(index_id);
+    auto& continue_cond = dfg.get_node(continue_id);
+
+    load_node.add_input("i1", index_id);               // Index from counter
+    index_node.add_output(load_id);
+    load_node.add_input("pred", continue_id);          // Predicated on continue condition
+    continue_cond.add_output(load_id);
 }
 
-void doda_mapper::add_load_node(const std::string& input_name) {
-    dfg.add_node(input_name, Opcode::LOAD);
-    auto& load_node = dfg.get_node(input_name);
-    auto& counter_node = dfg.get_node("counter");
-    auto& continue_cond = dfg.get_node("continue_condition");
+inline void doda_mapper::add_store_node(const std::string& store_id, const std::string& output_name,
+                                 int cluster, const std::string& prefix, const std::string& address_id) {
+    const std::string index_id = address_id.empty() ? prefix + "counter" : address_id;
+    const std::string continue_id = prefix + "continue_condition";
+    place_node(store_id, Opcode::STORE, cluster);       // Writes the SPM of its cluster
+    auto& store_node = dfg.get_node(store_id);
+    auto& index_node = dfg.get_node(index_id);
+    auto& continue_cond = dfg.get_node(continue_id);
+
+    store_node.add_input("i1", index_id);               // Index from counter
+    index_node.add_output(store_id);
+    store_node.add_input("i2", output_name);            // Data to store (output registered in construct_graph)
+    store_node.add_input("pred", continue_id);          // Predicated on continue condition
+    continue_cond.add_output(store_id);
+}
 
-    load_node.add_input("i1", "counter");              // Index from counter
-    counter_node.add_output(input_name);
-    load_node.add_input("pred", "continue_condition"); // Predicated on continue condition
-    continue_cond.add_output(input_name);
+inline std::string doda_mapper::add_store_join_nodes(const std::vector<std::string>& store_ids) {
+    // store_join_m = store_join_(m-1) + store m, so the last join fires after every store
+    std::string prev_id = store_ids[0];
+    for (size_t m = 1; m < store_ids.size(); m++) {
+        const std::string join_id = "store_join_" + std::to_string(m);
+        dfg.add_node(join_id, Opcode::ADD);
+        auto& join_node = dfg.get_node(join_id);
+        join_node.add_input("i1", prev_id);
+        dfg.get_node(prev_id).add_output(join_id);
+        join_node.add_input("i2", store_ids[m]);
+        dfg.get_node(store_ids[m]).add_output(join_id);
+        prev_id = join_id;
+    }
+    return prev_id;
 }
 
-void doda_mapper::add_store_node(const std::string& output_name) {
+inline void doda_mapper::add_reduction_nodes(const std::string& output_name, const nlohmann::json& reduction) {
+    // "reduction": {"op": "sum" | "min" | "max" | "and" | "or" | "xor", "init": <int>}
+    const std::string op = reduction.value("op", std::string());
+    const int init = reduction.value("init", 0);
+
+    // Loop-carried accumulator, seeded with its initial output like the counter. It fires once per
+    // element: accumulator = accumulator <op> element
+    if (op == "min" || op == "max") {
+        // accumulator = (accumulator < element) ? accumulator : element (CGT for max). The
+        // fabric compares unsigned, so the identities are 0xffffffff for min and 0 for max.
+        dfg.add_node("accumulator_cmp", op == "min" ? Opcode::CLT : Opcode::CGT);
+        dfg.add_node("accumulator", Opcode::SELECT, true, init);
+        auto& cmp_node = dfg.get_node("accumulator_cmp");
+        auto& acc_node = dfg.get_node("accumulator");
+
+        cmp_node.add_input("i1", "accumulator");
+        cmp_node.add_input("i2", output_name);          // Output registered in construct_graph
+        acc_node.add_output("accumulator_cmp");
+        acc_node.add_input("i1", "accumulator");        // Self-loop for accumulation
+        acc_node.add_output("accumulator");
+        acc_node.add_input("i2", output_name);
+        acc_node.add_input("pred", "accumulator_cmp");  // Selects i1 when true
+        cmp_node.add_output("accumulator");
+    } else {
+        Opcode acc_op = Opcode::UNSUPPORTED;
+        if (op == "sum") acc_op = Opcode::ADD;
+        else if (op == "and") acc_op = Opcode::AND;
+        else if (op == "or") acc_op = Opcode::OR;
+        else if (op == "xor") acc_op = Opcode::XOR;
+        if (acc_op == Opcode::UNSUPPORTED) {
+            throw std::runtime_error("Unsupported reduction op '" + op + "'");
+        }
+        dfg.add_node("accumulator", acc_op, true, init);
+        auto& acc_node = dfg.get_node("accumulator");
+        acc_node.add_input("i1", "accumulator");        // Self-loop for accumulation
+        acc_node.add_output("accumulator");
+        acc_node.add_input("i2", output_name);
+    }
+
+    // Store the accumulator to address 0 once, when the loop terminates
     dfg.add_node("store_output", Opcode::STORE);
     auto& store_node = dfg.get_node("store_output");
-    auto& counter_node = dfg.get_node("counter");
-    auto& continue_cond = dfg.get_node("continue_condition");
+    auto& acc_node = dfg.get_node("accumulator");
+    auto& terminal_cond = dfg.get_node("terminal_condition");
 
-    store_node.add_input("i1", "counter");              // Index from counter
-    counter_node.add_output("store_output");
-    store_node.add_input("i2", output_name);            // Data to store (output registered in convert_json_to_dfg)
-    store_node.add_input("pred", "continue_condition"); // Predicated on continue condition
-    continue_cond.add_output("store_output");
+    store_node.add_input("i1", 0);                      // Result address
+    store_node.add_input("i2", "accumulator");
+    acc_node.add_output("store_output");
+    store_node.add_input("pred", "terminal_condition"); // Only the final value is stored
+    terminal_cond.add_output("store_output");
 }
 
-void doda_mapper::add_terminal_node() {
+inline void doda_mapper::add_terminal_node(const std::string& store_id) {
     dfg.add_node("terminal", Opcode::JUMP);
     auto& terminal_node = dfg.get_node("terminal");
-    auto& store_node = dfg.get_node("store_output");
+    auto& store_node = dfg.get_node(store_id);
     auto& terminal_cond = dfg.get_node("terminal_condition");
 
     terminal_node.add_input("i1", 100);                    // Jump target (artificial)
-    terminal_node.add_input("i2", "store_output");         // Dependency on store completion
+    terminal_node.add_input("i2", store_id);               // Dependency on store completion
     store_node.add_output("terminal");
     terminal_node.add_input("pred", "terminal_condition"); // Predicated on terminal condition
     terminal_cond.add_output("terminal");
 }
 
-void doda_mapper::resolve_input_pe_indices() {
+inline PlacementReport doda_mapper::place_nodes(Mapper_DFG& target_dfg) {
+    const int num_clusters = doda_mapper_utils::BitstreamConstants::NUM_CLUSTER;
+    const int pes_per_cluster = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER;
+    PlacementReport report;
+
+    // Nodes in PE order
+    std::vector<Mapper_Node*> nodes;
+    for (auto& [id, node] : target_dfg.m_nodes) {
+        nodes.push_back(&node);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const Mapper_Node* a, const Mapper_Node* b) {
+        return a->get_pe_index() < b->get_pe_index();
+    });
+    const int n = static_cast<int>(nodes.size());
+    if (n == 0) {
+        return report;
+    }
+    if (nodes.front()->get_pe_index() < 0 || nodes.back()->get_pe_index() >= num_clusters * pes_per_cluster) {
+        std::cerr << "[place_nodes] Warning: PE indices out of range, placement skipped" << std::endl;
+        return report;
+    }
+    std::map<std::string, int> index;
+    for (int i = 0; i < n; i++) {
+        index[nodes[i]->get_id()] = i;
+    }
+
+    // Producer-consumer edges (a node reading one source on several ports is one edge)
+    std::set<std::pair<int, int>> edges;
+    for (int v = 0; v < n; v++) {
+        for (const auto& input : nodes[v]->get_inputs()) {
+            auto it = index.find(input.get_id());
+            if (input.get_id() != "const" && it != index.end() && it->second != v) {
+                edges.emplace(it->second, v);
+            }
+        }
+    }
+    report.num_edges = static_cast<int>(edges.size());
+
+    // Longest paths over a topological order; edges on a cycle (loop-carried values) are left out
+    std::vector<std::vector<int>> succ(n), pred(n);
+    std::vector<int> in_degree(n, 0);
+    for (const auto& [u, v] : edges) {
+        succ[u].push_back(v);
+        pred[v].push_back(u);
+        in_degree[v]++;
+    }
+    std::vector<int> order;
+    for (int v = 0; v < n; v++) {
+        if (in_degree[v] == 0) order.push_back(v);
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        for (int s : succ[order[i]]) {
+            if (--in_degree[s] == 0) order.push_back(s);
+        }
+    }
+    std::vector<bool> acyclic(n, false);
+    for (int v : order) acyclic[v] = true;
+
+    std::vector<int> depth(n, 1), height(n, 1);    // Longest path ending / starting at a node
+    for (int v : order) {
+        for (int s : succ[v]) depth[s] = std::max(depth[s], depth[v] + 1);
+    }
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        for (int s : succ[*it]) height[*it] = std::max(height[*it], height[s] + 1);
+    }
+    for (int v : order) {
+        report.critical_path_length = std::max(report.critical_path_length, depth[v]);
+    }
+    auto is_critical = [&](int u, int v) {
+        return acyclic[u] && acyclic[v] && depth[u] + height[v] == report.critical_path_length;
+    };
+
+    // Symmetric edge weights
+    std::vector<int> weight(static_cast<size_t>(n) * n, 0);
+    std::vector<std::vector<int>> neighbors(n);
+    for (const auto& [u, v] : edges) {
+        const int w = is_critical(u, v) ? CRITICAL_EDGE_WEIGHT : 1;
+        if (weight[u * n + v] == 0) {
+            neighbors[u].push_back(v);
+            neighbors[v].push_back(u);
+        }
+        weight[u * n + v] += w;
+        weight[v * n + u] += w;
+    }
+
+    std::vector<int> initial_cluster(n);
+    std::vector<bool> fixed(n);
+    for (int v = 0; v < n; v++) {
+        initial_cluster[v] = nodes[v]->get_pe_index() / pes_per_cluster;
+        fixed[v] = target_dfg.pinned_pe_idx.count(nodes[v]->get_pe_index()) ||
+                   nodes[v]->get_opcode() == Opcode::LOAD || nodes[v]->get_opcode() == Opcode::STORE;    // Tied to the cluster's SPM
+    }
+
+    auto weighted_cut = [&](const std::vector<int>& cluster) {
+        int cut = 0;
+        for (const auto& [u, v] : edges) {
+            if (cluster[u] != cluster[v]) cut += weight[u * n + v];
+        }
+        return cut;
+    };
+    auto cut_edges = [&](const std::vector<int>& cluster) {
+        int cut = 0;
+        for (const auto& [u, v] : edges) cut += cluster[u] != cluster[v];
+        return cut;
+    };
+    auto critical_hops = [&](const std::vector<int>& cluster) {
+        std::vector<int> hops(n, 0);
+        int most = 0;
+        for (int v : order) {
+            for (int u : pred[v]) {
+                if (is_critical(u, v)) hops[v] = std::max(hops[v], hops[u] + (cluster[u] != cluster[v]));
+            }
+            most = std::max(most, hops[v]);
+        }
+        return most;
+    };
+    report.cut_edges_before = cut_edges(initial_cluster);
+    report.critical_hops_before = critical_hops(initial_cluster);
+
+    // Greedy graph growing: fill the clusters in turn, starting from their fixed nodes and
+    // taking the free node most connected to the cluster (ties: the neighbour of the node
+    // added last, so chains stay together). A cluster with nothing connected left is closed
+    // early if the remaining clusters can still hold the remaining nodes.
+    auto grow = [&]() {
+        std::vector<int> cluster(n, -1), count(num_clusters, 0);
+        int unassigned = 0;
+        for (int v = 0; v < n; v++) {
+            if (fixed[v]) {
+                cluster[v] = initial_cluster[v];
+                count[cluster[v]]++;
+            } else {
+                unassigned++;
+            }
+        }
+        std::vector<int> touched(n, -1);    // Step at which a neighbour last joined the cluster
+        int step = 0;
+        for (int c = 0; c < num_clusters && unassigned > 0; c++) {
+            int room_after = 0;
+            for (int later = c + 1; later < num_clusters; later++) room_after += pes_per_cluster - count[later];
+            while (count[c] < pes_per_cluster && unassigned > 0) {
+                int best_v = -1, best_conn = -1;
+                for (int v = 0; v < n; v++) {
+                    if (cluster[v] != -1) continue;
+                    int conn = 0, any = 0;
+                    for (int u : neighbors[v]) {
+                        if (cluster[u] == c) conn += weight[v * n + u];
+                        if (cluster[u] != -1) any += weight[v * n + u];
+                    }
+                    if (count[c] == 0) conn = any;    // Seed an empty cluster next to placed nodes
+                    if (best_v < 0 || conn > best_conn || (conn == best_conn && touched[v] > touched[best_v])) {
+                        best_v = v;
+                        best_conn = conn;
+                    }
+                }
+                if (best_conn == 0 && count[c] > 0 && unassigned <= room_after) {
+                    break;
+                }
+                cluster[best_v] = c;
+                count[c]++;
+                unassigned--;
+                step++;
+                for (int u : neighbors[best_v]) touched[u] = step;
+            }
+        }
+        return cluster;
+    };
+
+    // Apply the best single move, else the best swap, while either lowers the weighted cut
+    // (each step lowers it by at least 1, so this terminates)
+    auto refine = [&](std::vector<int>& cluster) {
+        std::vector<int> count(num_clusters, 0);
+        for (int v = 0; v < n; v++) count[cluster[v]]++;
+
+        // Decrease of the weighted cut if node v moved to cluster c
+        auto move_gain = [&](int v, int c) {
+            int gain = 0;
+            for (int u : neighbors[v]) {
+                gain += weight[v * n + u] * ((cluster[u] != cluster[v]) - (cluster[u] != c));
+            }
+            return gain;
+        };
+
+        while (true) {
+            int best_gain = 0, best_v = -1, best_c = -1;
+            for (int v = 0; v < n; v++) {
+                if (fixed[v]) continue;
+                for (int c = 0; c < num_clusters; c++) {
+                    if (c == cluster[v] || count[c] >= pes_per_cluster) continue;
+                    const int gain = move_gain(v, c);
+                    if (gain > best_gain) {
+                        best_gain = gain;
+                        best_v = v;
+                        best_c = c;
+                    }
+                }
+            }
+            if (best_v >= 0) {
+                count[cluster[best_v]]--;
+                count[best_c]++;
+                cluster[best_v] = best_c;
+                continue;
+            }
+
+            int best_a = -1, best_b = -1;
+            for (int a = 0; a < n; a++) {
+                if (fixed[a]) continue;
+                for (int b = a + 1; b < n; b++) {
+                    if (fixed[b] || cluster[a] == cluster[b]) continue;
+                    const int gain = move_gain(a, cluster[b]) + move_gain(b, cluster[a]) - 2 * weight[a * n + b];
+                    if (gain > best_gain) {
+                        best_gain = gain;
+                        best_a = a;
+                        best_b = b;
+                    }
+                }
+            }
+            if (best_a < 0) {
+                break;
+            }
+            std::swap(cluster[best_a], cluster[best_b]);
+        }
+    };
+
+    // Refine both the creation order and the grown partition; on a tie the creation order wins,
+    // so graphs that already fit are left as they are
+    std::vector<int> cluster = initial_cluster;
+    refine(cluster);
+    std::vector<int> grown = grow();
+    refine(grown);
+    if (weighted_cut(grown) < weighted_cut(cluster)) {
+        cluster = grown;
+    }
+
+    // Nodes that stayed keep their PE; moved nodes take the lowest free PEs of their new
+    // cluster, in their original order
+    std::set<int> taken;
+    for (int v = 0; v < n; v++) {
+        if (cluster[v] == initial_cluster[v]) taken.insert(nodes[v]->get_pe_index());
+    }
+    for (int v = 0; v < n; v++) {
+        if (cluster[v] == initial_cluster[v]) continue;
+        int pe_idx = cluster[v] * pes_per_cluster;
+        while (taken.count(pe_idx)) pe_idx++;
+        taken.insert(pe_idx);
+        nodes[v]->set_pe_index(pe_idx);
+        report.moved_nodes++;
+    }
+
+    report.cut_edges = cut_edges(cluster);
+    report.critical_hops = critical_hops(cluster);
+    for (int v = 0; v < n; v++) {
+        report.nodes_per_cluster[cluster[v]]++;
+    }
+
+    std::cout << "[place_nodes] Cut edges: " << report.cut_edges_before << " -> " << report.cut_edges
+              << " of " << report.num_edges << ", critical-path hops: " << report.critical_hops_before
+              << " -> " << report.critical_hops << " (longest path " << report.critical_path_length
+              << " nodes), " << report.moved_nodes << " nodes moved" << std::endl;
+    return report;
+}
+
+inline int doda_mapper::balance_trees(Mapper_DFG& target_dfg) {
+    auto is_associative = [](Opcode op) {
+        return op == Opcode::ADD || op == Opcode::MUL || op == Opcode::AND || op == Opcode::OR || op == Opcode::XOR;
+    };
+
+    std::vector<Mapper_Node*> nodes;
+    std::map<std::string, int> index;
+    for (auto& [id, node] : target_dfg.m_nodes) {
+        index[id] = static_cast<int>(nodes.size());
+        nodes.push_back(&node);
+    }
+    const int n = static_cast<int>(nodes.size());
+
+    std::set<int> visited_roots;
+    int longest_before = 0, longest_after = 0;
+    int trees = 0, rewired = 0;
+    while (true) {
+        // Reads of each node (one entry per port) and longest paths, in nodes, over the acyclic part
+        std::vector<std::vector<int>> reads(n), succ(n);
+        std::vector<int> in_degree(n, 0);
+        for (int v = 0; v < n; v++) {
+            std::set<int> sources;
+            for (const auto& input : nodes[v]->get_inputs()) {
+                auto it = index.find(input.get_id());
+                if (input.get_id() == "const" || it == index.end()) continue;
+                reads[it->second].push_back(v);
+                if (it->second != v && sources.insert(it->second).second) {
+                    succ[it->second].push_back(v);
+                    in_degree[v]++;
+                }
+            }
+        }
+        std::vector<int> order;
+        for (int v = 0; v < n; v++) {
+            if (in_degree[v] == 0) order.push_back(v);
+        }
+        for (size_t i = 0; i < order.size(); i++) {
+            for (int s : succ[order[i]]) {
+                if (--in_degree[s] == 0) order.push_back(s);
+            }
+        }
+        std::vector<bool> acyclic(n, false);
+        std::vector<int> depth(n, 1);
+        for (int v : order) {
+            acyclic[v] = true;
+            for (int s : succ[v]) depth[s] = std::max(depth[s], depth[v] + 1);
+        }
+        longest_after = 0;
+        for (int v : order) longest_after = std::max(longest_after, depth[v]);
+        if (visited_roots.empty()) longest_before = longest_after;
+
+        // A tree node computes op(i1, i2) with no predicate and no loop-carried value; it is absorbed
+        // into its consumer when that is the only read of it and the consumer has the same op
+        auto is_tree_node = [&](int v) {
+            const Mapper_Node& node = *nodes[v];
+            if (!is_associative(node.get_opcode()) || node.is_initial_output_used() || !acyclic[v]) return false;
+            int data_inputs = 0;
+            for (const auto& input : node.get_inputs()) {
+                if (input.get_type() != "i1" && input.get_type() != "i2") return false;
+                data_inputs++;
+            }
+            return data_inputs == 2;
+        };
+        auto is_absorbed = [&](int v) {
+            return is_tree_node(v) && reads[v].size() == 1 && is_tree_node(reads[v][0]) &&
+                   nodes[reads[v][0]]->get_opcode() == nodes[v]->get_opcode();
+        };
+
+        int root = -1;
+        for (int v : order) {
+            if (is_tree_node(v) && !is_absorbed(v) && !visited_roots.count(v)) {
+                root = v;
+                break;
+            }
+        }
+        if (root < 0) break;
+        visited_roots.insert(root);
+
+        // Members of the tree in depth-first order, and its leaves: nodes outside the tree or constants
+        struct Leaf {
+            int ready;          // Longest path ending at the value, in nodes (0 for a constant)
+            int seq;            // Tie-break, so the result does not depend on heap internals
+            int node;           // Index in nodes, or -1 for a constant
+            int const_value;
+            int member;         // Tree member computing the value, or -1 for a leaf
+        };
+        std::vector<int> members;
+        std::vector<Leaf> leaves;
+        std::function<void(int)> collect = [&](int v) {
+            members.push_back(v);
+            for (const auto& input : nodes[v]->get_inputs()) {
+                auto it = index.find(input.get_id());
+                if (input.get_id() == "const" || it == index.end()) {
+                    leaves.push_back({0, static_cast<int>(leaves.size()), -1, input.get_const_value(), -1});
+                } else if (it->second != root && is_absorbed(it->second)) {
+                    collect(it->second);
+                } else {
+                    leaves.push_back({depth[it->second], static_cast<int>(leaves.size()), it->second, 0, -1});
+                }
+            }
+        };
+        collect(root);
+        const bool has_node_leaf = std::any_of(leaves.begin(), leaves.end(), [](const Leaf& leaf) { return leaf.node >= 0; });
+        if (members.size() < 2 || !has_node_leaf) continue;
+
+        // Combine the two earliest values first (a constant is paired with a node value, so every
+        // member keeps reading at least one node); the last combination is the root
+        auto later = [](const Leaf& a, const Leaf& b) { return std::tie(a.ready, a.seq) > std::tie(b.ready, b.seq); };
+        std::vector<Leaf> heap = leaves;
+        std::make_heap(heap.begin(), heap.end(), later);
+        auto pop = [&]() {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            Leaf leaf = heap.back();
+            heap.pop_back();
+            return leaf;
+        };
+        auto push = [&](const Leaf& leaf) {
+            heap.push_back(leaf);
+            std::push_heap(heap.begin(), heap.end(), later);
+        };
+        struct Combination {
+            Leaf a, b;
+            int member;
+        };
+        std::vector<Combination> combinations;
+        int seq = static_cast<int>(leaves.size());
+        size_t next_member = 1;     // members[0] is the root
+        while (heap.size() > 1) {
+            Leaf a = pop();
+            Leaf b = pop();
+            if (a.node < 0 && a.member < 0 && b.node < 0 && b.member < 0) {
+                std::vector<Leaf> constants = {b};
+                while (!heap.empty() && heap.front().node < 0 && heap.front().member < 0) constants.push_back(pop());
+                b = pop();
+                for (const Leaf& constant : constants) push(constant);
+            }
+            const int member = heap.empty() ? members[0] : members[next_member++];
+            combinations.push_back({a, b, member});
+            push({std::max(a.ready, b.ready) + 1, seq++, -1, 0, member});
+        }
+        if (heap.front().ready >= depth[root]) continue;
+
+        // Rewire the members; producers drop their outputs to members and register the new reads
+        const std::set<int> member_set(members.begin(), members.end());
+        auto source_of = [&](const Leaf& leaf) { return leaf.member >= 0 ? leaf.member : leaf.node; };
+        std::set<int> producers;
+        for (const auto& combination : combinations) {
+            if (source_of(combination.a) >= 0) producers.insert(source_of(combination.a));
+            if (source_of(combination.b) >= 0) producers.insert(source_of(combination.b));
+        }
+        for (int v : members) {
+            for (const auto& input : nodes[v]->get_inputs()) {
+                auto it = index.find(input.get_id());
+                if (it != index.end()) producers.insert(it->second);
+            }
+        }
+        for (int p : producers) {
+            auto& outputs = const_cast<std::vector<Output>&>(nodes[p]->get_outputs());
+            outputs.erase(std::remove_if(outputs.begin(), outputs.end(), [&](const Output& output) {
+                auto it = index.find(output.get_id());
+                return it != index.end() && member_set.count(it->second);
+            }), outputs.end());
+        }
+        for (const auto& combination : combinations) {
+            Mapper_Node& node = *nodes[combination.member];
+            auto& inputs = const_cast<std::vector<Input>&>(node.get_inputs());
+            inputs.clear();
+            for (const Leaf* operand : {&combination.a, &combination.b}) {
+                const char* type = inputs.empty() ? "i1" : "i2";
+                const int source = source_of(*operand);
+                if (source < 0) {
+                    node.add_input(type, operand->const_value);
+                    continue;
+                }
+                node.add_input(type, nodes[source]->get_id());
+                inputs.back().set_src_pe_index(nodes[source]->get_pe_index());
+                nodes[source]->add_output(node.get_id());
+                const_cast<std::vector<Output>&>(nodes[source]->get_outputs()).back().set_dst_pe_index(node.get_pe_index());
+            }
+        }
+        trees++;
+        rewired += static_cast<int>(members.size());
+    }
+
+    if (trees > 0) {
+        std::cout << "[balance_trees] Rebalanced " << trees << " trees (" << rewired << " nodes), longest path: "
+                  << longest_before << " -> " << longest_after << " nodes" << std::endl;
+    }
+    return trees;
+}
+
+inline int doda_mapper::split_fanout(Mapper_DFG& target_dfg) {
+    const int num_clusters = doda_mapper_utils::BitstreamConstants::NUM_CLUSTER;
+    const int pes_per_cluster = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER;
+    auto cluster_of = [&](const Mapper_Node& node) { return node.get_pe_index() / pes_per_cluster; };
+
+    std::set<int> taken;
+    for (const auto& [id, node] : target_dfg.m_nodes) {
+        if (node.get_pe_index() < 0 || node.get_pe_index() >= num_clusters * pes_per_cluster) {
+            std::cerr << "[split_fanout] Warning: PE indices out of range, fanout splitting skipped" << std::endl;
+            return 0;
+        }
+        taken.insert(node.get_pe_index());
+    }
+
+    // Distinct consumers of each node, self-loops excluded
+    auto consumers_of = [&]() {
+        std::map<std::string, std::vector<std::string>> consumers;
+        for (const auto& [id, node] : target_dfg.m_nodes) {
+            std::set<std::string> sources;
+            for (const auto& input : node.get_inputs()) {
+                if (input.get_id() != "const" && input.get_id() != id && sources.insert(input.get_id()).second) {
+                    consumers[input.get_id()].push_back(id);
+                }
+            }
+        }
+        return consumers;
+    };
+    // (node, remote cluster) pairs: the bits set in the DST cluster OH-keys
+    auto remote_destinations = [&]() {
+        int count = 0;
+        for (const auto& [id, consumers] : consumers_of()) {
+            if (!target_dfg.has_node(id)) continue;
+            std::set<int> clusters;
+            for (const auto& consumer : consumers) clusters.insert(cluster_of(target_dfg.get_node(consumer)));
+            count += static_cast<int>(clusters.size()) - static_cast<int>(clusters.count(cluster_of(target_dfg.get_node(id))));
+        }
+        return count;
+    };
+    const int remote_before = remote_destinations();
+
+    // Producers before consumers, so a copied counter is in place when its loop conditions are split
+    const std::map<std::string, std::vector<std::string>> consumers = consumers_of();
+    std::map<std::string, int> in_degree;
+    for (const auto& [id, node] : target_dfg.m_nodes) in_degree[id];
+    for (const auto& [id, list] : consumers) {
+        for (const auto& consumer : list) in_degree[consumer]++;
+    }
+    std::vector<std::string> order;
+    for (const auto& [id, degree] : in_degree) {
+        if (degree == 0) order.push_back(id);
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        auto it = consumers.find(order[i]);
+        if (it == consumers.end()) continue;
+        for (const auto& consumer : it->second) {
+            if (--in_degree[consumer] == 0) order.push_back(consumer);
+        }
+    }
+
+    std::map<std::string, std::map<int, std::string>> copies;     // node -> cluster -> copy in that cluster
+    int num_copies = 0;
+    std::set<std::string> split;
+    for (const std::string& id : order) {
+        Mapper_Node& node = target_dfg.get_node(id);
+        const Opcode op = node.get_opcode();
+        if (op == Opcode::LOAD || op == Opcode::STORE || op == Opcode::JUMP || op == Opcode::NIL) continue;
+        const std::vector<std::string> readers = consumers_of()[id];
+        if (readers.size() <= static_cast<size_t>(FANOUT_THRESHOLD)) continue;
+
+        // The terminal condition stays single: the simulator counts one loop per counter that
+        // drives one (PackedBitstream::numLoops)
+        if (std::any_of(readers.begin(), readers.end(), [&](const std::string& reader) {
+                return target_dfg.get_node(reader).get_opcode() == Opcode::JUMP;
+            })) {
+            continue;
+        }
+
+        std::map<int, std::vector<std::string>> remote;     // Cluster -> consumers there
+        for (const auto& reader : readers) {
+            const int cluster = cluster_of(target_dfg.get_node(reader));
+            if (cluster != cluster_of(node)) remote[cluster].push_back(reader);
+        }
+
+        for (const auto& [cluster, local_readers] : remote) {
+            // The copy must read every input inside its cluster, from the producer or its copy there
+            std::vector<Input> inputs;
+            bool local = true;
+            for (const auto& input : node.get_inputs()) {
+                const std::string& src = input.get_id();
+                if (src == "const") {
+                    inputs.emplace_back(input.get_type(), input.get_const_value());
+                } else if (src == id) {
+                    inputs.emplace_back(input.get_type(), id + "_c" + std::to_string(cluster));
+                } else if (target_dfg.has_node(src) && cluster_of(target_dfg.get_node(src)) == cluster) {
+                    inputs.emplace_back(input.get_type(), src);
+                } else if (copies[src].count(cluster)) {
+                    inputs.emplace_back(input.get_type(), copies[src][cluster]);
+                } else {
+                    local = false;
+                }
+            }
+            const std::string copy_id = id + "_c" + std::to_string(cluster);
+            int pe_idx = cluster * pes_per_cluster;
+            while (taken.count(pe_idx)) pe_idx++;
+            if (!local || target_dfg.has_node(copy_id) || pe_idx >= (cluster + 1) * pes_per_cluster) continue;
+
+            taken.insert(pe_idx);
+            target_dfg.pinned_pe_idx.insert(pe_idx);
+            target_dfg.m_nodes.emplace(copy_id, Mapper_Node(copy_id, op, node.is_initial_output_used(),
+                                                            node.get_initial_output(), pe_idx));
+            Mapper_Node& copy = target_dfg.get_node(copy_id);
+            for (const auto& input : inputs) {
+                if (input.get_id() == "const") {
+                    copy.add_input(input.get_type(), input.get_const_value());
+                } else {
+                    copy.add_input(input.get_type(), input.get_id());
+                    target_dfg.get_node(input.get_id()).add_output(copy_id);
+                }
+            }
+
+            // The consumers in that cluster read the copy instead
+            auto& outputs = const_cast<std::vector<Output>&>(node.get_outputs());
+            for (const auto& reader_id : local_readers) {
+                for (auto& input : const_cast<std::vector<Input>&>(target_dfg.get_node(reader_id).get_inputs())) {
+                    if (input.get_id() == id) {
+                        input = Input(input.get_type(), copy_id);
+                        copy.add_output(reader_id);
+                    }
+                }
+                outputs.erase(std::remove_if(outputs.begin(), outputs.end(),
+                                             [&](const Output& output) { return output.get_id() == reader_id; }),
+                              outputs.end());
+            }
+            copies[id][cluster] = copy_id;
+            split.insert(id);
+            num_copies++;
+        }
+    }
+
+    if (num_copies > 0) {
+        std::cout << "[split_fanout] " << num_copies << " copies of " << split.size()
+                  << " nodes, remote destinations: " << remote_before << " -> " << remote_destinations() << std::endl;
+    }
+    return num_copies;
+}
+
+inline void doda_mapper::resolve_input_pe_indices(Mapper_DFG& target_dfg) {
     // Step 1: Build a mapping from node ID to PE index
     std::map<std::string, int> node_id_to_pe_index;
     
     // map all node IDs to their PE indices
-    for (const auto& [node_id, node] : dfg.m_nodes) {
+    for (const auto& [node_id, node] : target_dfg.m_nodes) {
         node_id_to_pe_index[node_id] = node.get_pe_index();
     }
     
     // Step 2: Go through all nodes and resolve their input dependencies
-    for (auto& [node_id, node] : dfg.m_nodes) {
+    for (auto& [node_id, node] : target_dfg.m_nodes) {
         auto& inputs = const_cast<std::vector<Input>&>(node.get_inputs());
         
         for (auto& input : inputs) {
@@ -484,7 +2167,7 @@ void doda_mapper::resolve_input_pe_indices() {
 #endif
 }
 
-std::string doda_mapper::node_to_bitstream(const Mapper_Node& node) {
+inline std::string doda_mapper::node_to_bitstream(const Mapper_Node& node) {
     using namespace doda_mapper_utils;
     
     // PE index (0 - NUM_CLUSTER*PES_PER_CLUSTER-1)
@@ -579,7 +2262,7 @@ std::string doda_mapper::node_to_bitstream(const Mapper_Node& node) {
             bin_pe_idx;
 }
 
-std::vector<std::vector<std::string>> doda_mapper::generate_bitstream(const Mapper_DFG& target_dfg) {
+inline std::vector<std::vector<std::string>> doda_mapper::generate_bitstream(const Mapper_DFG& target_dfg) {
     // DODA simulator expects: [cluster][instruction_index] -> binary_string
     const int num_clusters = doda_mapper_utils::BitstreamConstants::NUM_CLUSTER;
     const int num_pe_per_cluster = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER;
@@ -634,7 +2317,101 @@ std::vector<std::vector<std::string>> doda_mapper::generate_bitstream(const Mapp
     return bitstream;
 }
 
-void doda_mapper::print_debug_info() const {
+inline void doda_mapper::node_to_words(const Mapper_Node& node, uint32_t* words) {
+    using namespace doda_mapper_utils;
+
+    // Same fields and positions as node_to_bitstream, written LSB first
+    int pos = 0;
+    auto put = [&](uint32_t value, int width) {
+        for (int bit = 0; bit < width; bit++, pos++) {
+            if ((value >> bit) & 1u) {
+                words[pos / 32] |= 1u << (pos % 32);
+            }
+        }
+    };
+    for (int i = 0; i < WORDS_PER_INSTRUCTION; i++) {
+        words[i] = 0;
+    }
+
+    const int pe_idx = node.get_pe_index();
+
+    bool i1_used = false, i1_const_used = false;
+    bool i2_used = false, i2_const_used = false;
+    bool pred_used = false;
+    int i1_src_or_const = 0, i2_src_or_const = 0, pred_src = 0;
+    for (const auto& input : node.get_inputs()) {
+        const bool is_const = input.get_id() == "const";
+        const int value = is_const ? input.get_const_value() : input.get_src_pe_index();
+        if (input.get_type() == "i1") {
+            i1_used = true;
+            i1_const_used = is_const;
+            i1_src_or_const = value;
+        } else if (input.get_type() == "i2") {
+            i2_used = true;
+            i2_const_used = is_const;
+            i2_src_or_const = value;
+        } else if (input.get_type() == "pred") {
+            pred_used = true;
+            pred_src = input.get_src_pe_index();
+        }
+    }
+
+    int dst_oh = 0;
+    const int this_cluster = pe_idx / BitstreamConstants::PES_PER_CLUSTER;
+    for (const auto& output : node.get_outputs()) {
+        const int dst_cluster = output.get_dst_pe_index() / BitstreamConstants::PES_PER_CLUSTER;
+        if (dst_cluster != this_cluster) {
+            dst_oh |= (1 << dst_cluster);
+        }
+    }
+
+    put(static_cast<uint32_t>(pe_idx), BitstreamConstants::SRC_PE_IDX_WIDTH + log2_ceil(BitstreamConstants::NUM_CLUSTER));
+    put(i1_used, 1);
+    put(i1_const_used, 1);
+    put(static_cast<uint32_t>(i1_src_or_const), BitstreamConstants::DATA_WIDTH);
+    put(i2_used, 1);
+    put(i2_const_used, 1);
+    put(static_cast<uint32_t>(i2_src_or_const), BitstreamConstants::DATA_WIDTH);
+    put(pred_used, 1);
+    put(static_cast<uint32_t>(pred_src), BitstreamConstants::SRC_IDX_WIDTH);
+    put(node.is_initial_output_used(), 1);
+    put(static_cast<uint32_t>(node.get_initial_output()), BitstreamConstants::DATA_WIDTH);
+    put(static_cast<uint32_t>(node.get_opcode()), BitstreamConstants::OPCODE_WIDTH);
+    put(static_cast<uint32_t>(dst_oh), BitstreamConstants::NUM_CLUSTER);
+}
+
+inline size_t doda_mapper::generate_packed_bitstream(const Mapper_DFG& target_dfg, uint32_t* words, size_t capacity_words) {
+    const int num_clusters = doda_mapper_utils::BitstreamConstants::NUM_CLUSTER;
+    const int num_pe_per_cluster = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER;
+    const size_t required = static_cast<size_t>(num_clusters) * num_pe_per_cluster * WORDS_PER_INSTRUCTION;
+    if (words == nullptr || capacity_words < required) {
+        return required;
+    }
+
+    // Initialize with index only instructions, as generate_bitstream does
+    for (int idx = 0; idx < num_clusters * num_pe_per_cluster; idx++) {
+        uint32_t* instruction = words + static_cast<size_t>(idx) * WORDS_PER_INSTRUCTION;
+        instruction[0] = static_cast<uint32_t>(idx);
+        for (int i = 1; i < WORDS_PER_INSTRUCTION; i++) {
+            instruction[i] = 0;
+        }
+    }
+
+    for (const auto& [id, node] : target_dfg.get_nodes()) {
+        const int node_idx = node.get_pe_index();
+        if (node_idx < 0 || node_idx >= num_clusters * num_pe_per_cluster) {
+            std::cerr << "[generate_packed_bitstream] Error: Node " << id
+                      << " has invalid PE index " << node_idx << std::endl;
+            throw std::runtime_error("Invalid cluster or PE index for node");
+        }
+        node_to_words(node, words + static_cast<size_t>(node_idx) * WORDS_PER_INSTRUCTION);
+    }
+    return required;
+}
+
+inline void doda_mapper::print_debug_info() const {
     std::cout << "[doda_mapper] Final DFG structure:" << std::endl;
     std::cout << dfg << std::endl;
-}
\ No newline at end of file
+}
+
+#pragma GCC visibility pop
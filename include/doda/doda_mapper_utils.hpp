@@ -20,6 +20,7 @@ struct BitstreamConstants {
     static constexpr int OPCODE_WIDTH = 5;
     static constexpr int SRC_PE_IDX_WIDTH = 5; // log2(32 PEs per cluster)
     static constexpr int SRC_IDX_WIDTH = SRC_PE_IDX_WIDTH + NUM_CLUSTER; // 4 bits for cluster OH
+    static constexpr int SPM_ENTRIES = 256;    // Data memory entries per cluster (num_data_mem_entries)
 };
 
 /**
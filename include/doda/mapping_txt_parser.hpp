@@ -8,6 +8,9 @@
 #include <algorithm>
 #include <doda/doda_mapper.hpp>
 
+// Hidden for the same reason as doda_mapper.hpp: the parser builds this header's Mapper_DFG
+#pragma GCC visibility push(hidden)
+
 namespace doda_mapping_parser {
 
 /**
@@ -46,8 +49,6 @@ public:
             R"(type:\s*(\w+)\s*,\s*src_id:\s*([^\s(]+)\s*\(pe_index:\s*(-?\d+)\s*\)\s*,\s*const_value:\s*(-?\d+))"
         );
 
-        Mapper_Node::reset_node_counter();
-
         std::sregex_iterator node_it(content.begin(), content.end(), node_regex);
         std::sregex_iterator node_end;
 
@@ -132,3 +133,5 @@ public:
 };
 
 } // namespace doda_mapping_parser
+
+#pragma GCC visibility pop
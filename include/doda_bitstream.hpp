@@ -0,0 +1,515 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <utility>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Instruction field layout, matching doda_mapper::node_to_bitstream (bit 0 = LSB)
+struct InstructionLayout {
+    static constexpr int DATA_WIDTH = 32;
+    static constexpr int PE_IDX_LSB = 0;
+    static constexpr int PE_IDX_WIDTH = 7;          // 5 bits PE + 2 bits cluster
+    static constexpr int I1_USED = 7;
+    static constexpr int I1_CONST_USED = 8;
+    static constexpr int I1_LSB = 9;
+    static constexpr int I2_USED = 41;
+    static constexpr int I2_CONST_USED = 42;
+    static constexpr int I2_LSB = 43;
+    static constexpr int PRED_USED = 75;
+    static constexpr int PRED_SRC_LSB = 76;
+    static constexpr int PRED_SRC_WIDTH = 9;
+    static constexpr int INIT_USED = 85;
+    static constexpr int INIT_LSB = 86;
+    static constexpr int OPCODE_LSB = 118;
+    static constexpr int OPCODE_WIDTH = 5;
+    static constexpr int DST_OH_LSB = 123;
+    static constexpr int DST_OH_WIDTH = 4;
+
+    // Numeric values of the Opcode enum in doda/dfg_parser.hpp
+    static constexpr uint32_t OPCODE_ADD = 1;
+    static constexpr uint32_t OPCODE_AND = 6;
+    static constexpr uint32_t OPCODE_OR = 7;
+    static constexpr uint32_t OPCODE_XOR = 8;
+    static constexpr uint32_t OPCODE_SELECT = 9;
+    static constexpr uint32_t OPCODE_CLT = 12;
+    static constexpr uint32_t OPCODE_CGT = 14;
+    static constexpr uint32_t OPCODE_CGTE = 15;
+    static constexpr uint32_t OPCODE_STORE = 17;
+};
+
+// Packed DODA bitstream
+//
+// Each 128-bit PE instruction is stored as four little-endian uint32_t words,
+// word i holding instruction bits [32*i+31 : 32*i] (i.e. the value that goes
+// straight into io_v_inst_prog_in_<c>_bits[i]). Instructions are laid out
+// cluster-major: words[(cluster * num_pe_per_cluster + pe) * 4 + i].
+//
+// Binary file layout (host byte order, little-endian on all supported hosts):
+//   Header (24 bytes) | payload (num_clusters * num_pe_per_cluster * 4 words)
+//
+// The ASCII '0'/'1' text format ("# Cluster N bitstream" + one 128-character
+// line per PE) is kept as an import/export format for debugging.
+class PackedBitstream {
+public:
+    static constexpr uint32_t MAGIC = 0x41444F44;   // "DODA"
+    static constexpr uint16_t VERSION = 1;
+    static constexpr int WORDS_PER_INSTRUCTION = 4;
+    static constexpr int INSTRUCTION_BITS = WORDS_PER_INSTRUCTION * 32;
+
+    struct Header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t words_per_instruction;
+        uint32_t num_clusters;
+        uint32_t num_pe_per_cluster;
+        uint32_t checksum;              // FNV-1a over the payload bytes
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Header) == 24, "PackedBitstream::Header must stay 24 bytes");
+
+    PackedBitstream() = default;
+    PackedBitstream(int num_clusters, int num_pe_per_cluster)
+        : owned_(static_cast<size_t>(num_clusters) * num_pe_per_cluster * WORDS_PER_INSTRUCTION, 0),
+          num_clusters_(num_clusters), num_pe_per_cluster_(num_pe_per_cluster) {}
+
+    PackedBitstream(PackedBitstream&& other) noexcept { *this = std::move(other); }
+    PackedBitstream& operator=(PackedBitstream&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            owned_ = std::move(other.owned_);
+            map_base_ = other.map_base_;
+            map_size_ = other.map_size_;
+            num_clusters_ = other.num_clusters_;
+            num_pe_per_cluster_ = other.num_pe_per_cluster_;
+            other.map_base_ = nullptr;
+            other.map_size_ = 0;
+            other.num_clusters_ = 0;
+            other.num_pe_per_cluster_ = 0;
+        }
+        return *this;
+    }
+    PackedBitstream(const PackedBitstream&) = delete;
+    PackedBitstream& operator=(const PackedBitstream&) = delete;
+    ~PackedBitstream() { unmap(); }
+
+    // Deep copy (a mapped bitstream becomes an owned one)
+    PackedBitstream clone() const {
+        PackedBitstream copy(num_clusters_, num_pe_per_cluster_);
+        if (!copy.owned_.empty()) {
+            std::memcpy(copy.owned_.data(), data(), sizeBytes());
+        }
+        return copy;
+    }
+
+    // Geometry and raw access
+    int numClusters() const { return num_clusters_; }
+    int numPePerCluster() const { return num_pe_per_cluster_; }
+    bool empty() const { return sizeWords() == 0; }
+    bool isMapped() const { return map_base_ != nullptr; }
+    size_t sizeWords() const { return static_cast<size_t>(num_clusters_) * num_pe_per_cluster_ * WORDS_PER_INSTRUCTION; }
+    size_t sizeBytes() const { return sizeWords() * sizeof(uint32_t); }
+
+    const uint32_t* data() const {
+        return map_base_ ? reinterpret_cast<const uint32_t*>(static_cast<const char*>(map_base_) + sizeof(Header))
+                         : owned_.data();
+    }
+    const uint32_t* instruction(int cluster, int pe) const {
+        return data() + (static_cast<size_t>(cluster) * num_pe_per_cluster_ + pe) * WORDS_PER_INSTRUCTION;
+    }
+    uint32_t* mutableInstruction(int cluster, int pe) {
+        if (map_base_) throw std::logic_error("PackedBitstream: mapped bitstreams are read-only");
+        return owned_.data() + (static_cast<size_t>(cluster) * num_pe_per_cluster_ + pe) * WORDS_PER_INSTRUCTION;
+    }
+
+    uint32_t checksum() const { return computeChecksum(data(), sizeWords()); }
+
+    // 64-bit content hash (geometry + payload), used as a cache key
+    uint64_t contentHash() const {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const unsigned char* bytes, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+        };
+        uint32_t geometry[2] = {static_cast<uint32_t>(num_clusters_), static_cast<uint32_t>(num_pe_per_cluster_)};
+        mix(reinterpret_cast<const unsigned char*>(geometry), sizeof(geometry));
+        mix(reinterpret_cast<const unsigned char*>(data()), sizeBytes());
+        return hash;
+    }
+
+    bool sameContent(const PackedBitstream& other) const {
+        return num_clusters_ == other.num_clusters_ && num_pe_per_cluster_ == other.num_pe_per_cluster_ &&
+               (sizeBytes() == 0 || std::memcmp(data(), other.data(), sizeBytes()) == 0);
+    }
+
+    // Single instruction conversion
+    static void packInstruction(const std::string& bitstr, uint32_t* out) {
+        if (bitstr.size() != static_cast<size_t>(INSTRUCTION_BITS)) {
+            throw std::runtime_error("PackedBitstream: instruction must be " + std::to_string(INSTRUCTION_BITS) +
+                                     " bits, got " + std::to_string(bitstr.size()));
+        }
+        for (int i = 0; i < WORDS_PER_INSTRUCTION; i++) {
+            uint32_t value = 0;
+            const char* p = bitstr.data() + INSTRUCTION_BITS - (i + 1) * 32;
+            for (int b = 0; b < 32; b++) {
+                if (p[b] != '0' && p[b] != '1') {
+                    throw std::runtime_error("PackedBitstream: invalid character in instruction");
+                }
+                value = (value << 1) | static_cast<uint32_t>(p[b] - '0');
+            }
+            out[i] = value;
+        }
+    }
+
+    static std::string unpackInstruction(const uint32_t* words) {
+        std::string bitstr(INSTRUCTION_BITS, '0');
+        for (int bit = 0; bit < INSTRUCTION_BITS; bit++) {
+            if ((words[bit / 32] >> (bit % 32)) & 1u) {
+                bitstr[INSTRUCTION_BITS - 1 - bit] = '1';
+            }
+        }
+        return bitstr;
+    }
+
+    static uint32_t computeChecksum(const uint32_t* words, size_t num_words) {
+        uint32_t hash = 2166136261u;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(words);
+        for (size_t i = 0; i < num_words * sizeof(uint32_t); i++) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    // Instruction field access (bit 0 = LSB of word 0)
+    static uint32_t getField(const uint32_t* words, int lsb, int width) {
+        uint32_t value = 0;
+        for (int bit = 0; bit < width; bit++) {
+            int pos = lsb + bit;
+            value |= ((words[pos / 32] >> (pos % 32)) & 1u) << bit;
+        }
+        return value;
+    }
+
+    static void setField(uint32_t* words, int lsb, int width, uint32_t value) {
+        for (int bit = 0; bit < width; bit++) {
+            int pos = lsb + bit;
+            uint32_t mask = 1u << (pos % 32);
+            if ((value >> bit) & 1u) {
+                words[pos / 32] |= mask;
+            } else {
+                words[pos / 32] &= ~mask;
+            }
+        }
+    }
+
+    // Rewrite the vector-size constant of the loop-bound PEs (continue_condition /
+    // terminal_condition: CLT/CGTE whose i1 comes from a self-incrementing counter).
+    // Returns the number of patched instructions.
+    int setLoopBound(uint32_t bound) {
+        typedef InstructionLayout L;
+        const std::vector<uint32_t> counter_pes = counterPes();
+
+        int patched = 0;
+        for (int cluster = 0; cluster < num_clusters_; cluster++) {
+            for (int pe = 0; pe < num_pe_per_cluster_; pe++) {
+                if (loopBoundCounter(instruction(cluster, pe), counter_pes) >= 0) {
+                    setField(mutableInstruction(cluster, pe), L::I2_LSB, L::DATA_WIDTH, bound);
+                    patched++;
+                }
+            }
+        }
+        return patched;
+    }
+
+    // Number of independent loops, i.e. counters that drive a terminal condition (counter >= bound).
+    // A kernel replicated across clusters has one loop per replica, each over its own SPM
+    // partition. A counter copied next to its consumers (doda_mapper::split_fanout) only drives
+    // continue conditions and is part of the loop it copies.
+    int numLoops() const {
+        typedef InstructionLayout L;
+        const std::vector<uint32_t> counter_pes = counterPes();
+        std::vector<uint32_t> loop_counters;
+        for (int cluster = 0; cluster < num_clusters_; cluster++) {
+            for (int pe = 0; pe < num_pe_per_cluster_; pe++) {
+                const uint32_t* w = instruction(cluster, pe);
+                const int counter = loopBoundCounter(w, counter_pes);
+                if (counter >= 0 && getField(w, L::OPCODE_LSB, L::OPCODE_WIDTH) == L::OPCODE_CGTE &&
+                    std::find(loop_counters.begin(), loop_counters.end(),
+                                              static_cast<uint32_t>(counter)) == loop_counters.end()) {
+                    loop_counters.push_back(static_cast<uint32_t>(counter));
+                }
+            }
+        }
+        return static_cast<int>(loop_counters.size());
+    }
+
+    // Loop-bound constant of the first loop-bound PE, or -1 if there is none. A temporally
+    // partitioned kernel is compiled with its tile length as loop bound.
+    int64_t loopBound() const {
+        typedef InstructionLayout L;
+        const std::vector<uint32_t> counter_pes = counterPes();
+        for (int cluster = 0; cluster < num_clusters_; cluster++) {
+            for (int pe = 0; pe < num_pe_per_cluster_; pe++) {
+                if (loopBoundCounter(instruction(cluster, pe), counter_pes) >= 0) {
+                    return getField(instruction(cluster, pe), L::I2_LSB, L::DATA_WIDTH);
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Accumulator opcode of a reduction kernel (see doda_mapper::add_reduction_nodes): its only
+    // STORE writes a loop-carried accumulator to the constant address 0. For a min/max accumulator
+    // (a SELECT) the opcode of its compare is returned, CLT for min and CGT for max. Returns -1 if
+    // this configuration is not a reduction.
+    int reductionOpcode() const {
+        typedef InstructionLayout L;
+        int result = -1;
+        for (int cluster = 0; cluster < num_clusters_; cluster++) {
+            for (int pe = 0; pe < num_pe_per_cluster_; pe++) {
+                const uint32_t* w = instruction(cluster, pe);
+                if (getField(w, L::OPCODE_LSB, L::OPCODE_WIDTH) != L::OPCODE_STORE) continue;
+                if (result >= 0 ||
+                    !getField(w, L::I1_USED, 1) || !getField(w, L::I1_CONST_USED, 1) ||
+                    getField(w, L::I1_LSB, L::DATA_WIDTH) != 0 ||
+                    !getField(w, L::I2_USED, 1) || getField(w, L::I2_CONST_USED, 1)) {
+                    return -1;
+                }
+                const uint32_t* acc = peInstruction(getField(w, L::I2_LSB, L::DATA_WIDTH));
+                if (!acc || !getField(acc, L::INIT_USED, 1)) return -1;
+                uint32_t op = getField(acc, L::OPCODE_LSB, L::OPCODE_WIDTH);
+                if (op == L::OPCODE_SELECT) {
+                    const uint32_t* cmp = getField(acc, L::PRED_USED, 1) ?
+                        peInstruction(getField(acc, L::PRED_SRC_LSB, L::PRED_SRC_WIDTH)) : nullptr;
+                    if (!cmp) return -1;
+                    op = getField(cmp, L::OPCODE_LSB, L::OPCODE_WIDTH);
+                }
+                result = static_cast<int>(op);
+            }
+        }
+        return result;
+    }
+
+    // Text format import/export
+    static PackedBitstream fromText(const std::vector<std::vector<std::string>>& binary_instructions) {
+        size_t num_pe = 0;
+        for (const auto& cluster : binary_instructions) {
+            num_pe = std::max(num_pe, cluster.size());
+        }
+        PackedBitstream packed(static_cast<int>(binary_instructions.size()), static_cast<int>(num_pe));
+        for (size_t cluster = 0; cluster < binary_instructions.size(); cluster++) {
+            for (size_t pe = 0; pe < binary_instructions[cluster].size(); pe++) {
+                packInstruction(binary_instructions[cluster][pe],
+                                packed.mutableInstruction(static_cast<int>(cluster), static_cast<int>(pe)));
+            }
+        }
+        return packed;
+    }
+
+    std::vector<std::vector<std::string>> toText() const {
+        std::vector<std::vector<std::string>> text(num_clusters_);
+        for (int cluster = 0; cluster < num_clusters_; cluster++) {
+            text[cluster].reserve(num_pe_per_cluster_);
+            for (int pe = 0; pe < num_pe_per_cluster_; pe++) {
+                text[cluster].push_back(unpackInstruction(instruction(cluster, pe)));
+            }
+        }
+        return text;
+    }
+
+    static PackedBitstream readText(const std::string& path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open bitstream file: " + path);
+        }
+
+        std::vector<std::vector<std::string>> instructions;
+        std::vector<std::string> current_cluster;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) {
+                if (!current_cluster.empty()) {
+                    instructions.push_back(current_cluster);
+                    current_cluster.clear();
+                }
+            } else if (line[0] == '#') {
+                continue;
+            } else {
+                current_cluster.push_back(line);
+            }
+        }
+        if (!current_cluster.empty()) {
+            instructions.push_back(current_cluster);
+        }
+        return fromText(instructions);
+    }
+
+    void writeText(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            throw std::runtime_error("Failed to write bitstream file: " + path);
+        }
+        for (int cluster = 0; cluster < num_clusters_; cluster++) {
+            out << "# Cluster " << cluster << " bitstream\n";
+            for (int pe = 0; pe < num_pe_per_cluster_; pe++) {
+                out << unpackInstruction(instruction(cluster, pe)) << "\n";
+            }
+            out << "\n";
+        }
+    }
+
+    // Unique per process and thread, for write-then-rename temporaries
+    static std::string tempSuffix() {
+        return ".tmp." + std::to_string(::getpid()) + "." +
+               std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    }
+
+    // Binary format
+    void writeBinary(const std::string& path) const {
+        Header header;
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.words_per_instruction = WORDS_PER_INSTRUCTION;
+        header.num_clusters = static_cast<uint32_t>(num_clusters_);
+        header.num_pe_per_cluster = static_cast<uint32_t>(num_pe_per_cluster_);
+        header.checksum = checksum();
+        header.reserved = 0;
+
+        // Write to a temporary file and rename, so a concurrent reader never maps a partial file
+        std::string tmp_path = path + tempSuffix();
+        {
+            std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                throw std::runtime_error("Failed to write bitstream file: " + path);
+            }
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(data()), static_cast<std::streamsize>(sizeBytes()));
+            if (!out) {
+                throw std::runtime_error("Failed to write bitstream file: " + path);
+            }
+        }
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("Failed to write bitstream file: " + path);
+        }
+    }
+
+    // Memory-map a binary bitstream. The payload is used in place (no copy, no parsing).
+    static PackedBitstream map(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open bitstream file: " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+            ::close(fd);
+            throw std::runtime_error("Bitstream file too small: " + path);
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void* base = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("Failed to map bitstream file: " + path);
+        }
+
+        PackedBitstream packed;
+        packed.map_base_ = base;
+        packed.map_size_ = size;
+
+        const Header* header = static_cast<const Header*>(base);
+        if (header->magic != MAGIC || header->version != VERSION ||
+            header->words_per_instruction != WORDS_PER_INSTRUCTION) {
+            throw std::runtime_error("Not a packed DODA bitstream (bad header): " + path);
+        }
+        packed.num_clusters_ = static_cast<int>(header->num_clusters);
+        packed.num_pe_per_cluster_ = static_cast<int>(header->num_pe_per_cluster);
+        if (sizeof(Header) + packed.sizeBytes() != size) {
+            throw std::runtime_error("Bitstream file size does not match its header: " + path);
+        }
+        if (packed.checksum() != header->checksum) {
+            throw std::runtime_error("Bitstream checksum mismatch: " + path);
+        }
+        return packed;
+    }
+
+    // Load either format, detected by the magic number
+    static PackedBitstream load(const std::string& path) {
+        uint32_t magic = 0;
+        {
+            std::ifstream probe(path, std::ios::binary);
+            if (!probe.is_open()) {
+                throw std::runtime_error("Failed to open bitstream file: " + path);
+            }
+            probe.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        }
+        return magic == MAGIC ? map(path) : readText(path);
+    }
+
+private:
+    // Instruction of a global PE index (cluster * num_pe_per_cluster + pe), or nullptr if out of range
+    const uint32_t* peInstruction(uint32_t pe_idx) const {
+        if (num_pe_per_cluster_ == 0 || pe_idx >= static_cast<uint32_t>(num_clusters_ * num_pe_per_cluster_)) {
+            return nullptr;
+        }
+        return instruction(static_cast<int>(pe_idx) / num_pe_per_cluster_, static_cast<int>(pe_idx) % num_pe_per_cluster_);
+    }
+
+    // PE indices of self-incrementing counters (ADD with an initial output and i1 from itself)
+    std::vector<uint32_t> counterPes() const {
+        typedef InstructionLayout L;
+        std::vector<uint32_t> counter_pes;
+        for (int cluster = 0; cluster < num_clusters_; cluster++) {
+            for (int pe = 0; pe < num_pe_per_cluster_; pe++) {
+                const uint32_t* w = instruction(cluster, pe);
+                if (getField(w, L::OPCODE_LSB, L::OPCODE_WIDTH) == L::OPCODE_ADD &&
+                    getField(w, L::INIT_USED, 1) && getField(w, L::I1_USED, 1) && !getField(w, L::I1_CONST_USED, 1) &&
+                    getField(w, L::I1_LSB, L::DATA_WIDTH) == getField(w, L::PE_IDX_LSB, L::PE_IDX_WIDTH)) {
+                    counter_pes.push_back(getField(w, L::PE_IDX_LSB, L::PE_IDX_WIDTH));
+                }
+            }
+        }
+        return counter_pes;
+    }
+
+    // The counter a loop-bound PE (CLT/CGTE of a counter against a constant) compares, or -1
+    static int loopBoundCounter(const uint32_t* w, const std::vector<uint32_t>& counter_pes) {
+        typedef InstructionLayout L;
+        const uint32_t op = getField(w, L::OPCODE_LSB, L::OPCODE_WIDTH);
+        if ((op == L::OPCODE_CLT || op == L::OPCODE_CGTE) &&
+            getField(w, L::I1_USED, 1) && !getField(w, L::I1_CONST_USED, 1) &&
+            std::find(counter_pes.begin(), counter_pes.end(), getField(w, L::I1_LSB, L::DATA_WIDTH)) != counter_pes.end() &&
+            getField(w, L::I2_USED, 1) && getField(w, L::I2_CONST_USED, 1)) {
+            return static_cast<int>(getField(w, L::I1_LSB, L::DATA_WIDTH));
+        }
+        return -1;
+    }
+
+    std::vector<uint32_t> owned_;
+    void* map_base_ = nullptr;
+    size_t map_size_ = 0;
+    int num_clusters_ = 0;
+    int num_pe_per_cluster_ = 0;
+
+    void unmap() {
+        if (map_base_) {
+            ::munmap(map_base_, map_size_);
+            map_base_ = nullptr;
+            map_size_ = 0;
+        }
+    }
+};
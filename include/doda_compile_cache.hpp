@@ -0,0 +1,247 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "doda_bitstream.hpp"
+
+// Content-addressed on-disk cache of compiled bitstreams.
+//
+// Entries are packed bitstreams stored as <dir>/<key>.bin, where the key hashes the DFG
+// text (with runtime metadata applied) and the compiler version. A kernel split into several
+// configurations keeps phase p >= 1 in <dir>/<key>_phase<p>.bin; these are written before
+// <key>.bin, removed after it and count as part of its entry. Single-entry lookups need no
+// lock: entries are published with an atomic rename and validated (header + checksum) when
+// mapped. Compiling a key runs under an flock() on <dir>/<key>.lock and eviction under
+// <dir>/.lock, so several threads and processes can share one cache and still compile
+// different kernels in parallel. Beyond max_entries, the least recently used entries are
+// removed (a hit refreshes the entry's mtime). Lock files are never removed: another process
+// may hold or wait on one, and a new file at the same path would not exclude it.
+class DODACompileCache {
+public:
+    // Defaults: ./obj/compile_cache, 256 entries; overridable with $DODA_COMPILE_CACHE_DIR and
+    // $DODA_COMPILE_CACHE_MAX_ENTRIES (0 disables the cache)
+    DODACompileCache() : dir_("./obj/compile_cache"), max_entries_(256) {
+        if (const char* dir = std::getenv("DODA_COMPILE_CACHE_DIR")) dir_ = dir;
+        if (const char* max = std::getenv("DODA_COMPILE_CACHE_MAX_ENTRIES")) max_entries_ = std::strtoul(max, nullptr, 10);
+    }
+    DODACompileCache(const std::string& dir, size_t max_entries) : dir_(dir), max_entries_(max_entries) {}
+
+    bool enabled() const { return max_entries_ > 0; }
+    const std::string& dir() const { return dir_; }
+    size_t maxEntries() const { return max_entries_; }
+
+    static std::string makeKey(const std::string& dfg_text, const std::string& compiler_version) {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const std::string& text) {
+            for (unsigned char c : text) {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            }
+            hash ^= 0xff;   // Separator, so ("ab", "c") and ("a", "bc") differ
+            hash *= 1099511628211ull;
+        };
+        mix(dfg_text);
+        mix(compiler_version);
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash));
+        return buf;
+    }
+
+    std::string entryPath(const std::string& key) const { return dir_ + "/" + key + ".bin"; }
+    std::string phaseEntryPath(const std::string& key, size_t phase) const {
+        return phase == 0 ? entryPath(key) : dir_ + "/" + key + "_phase" + std::to_string(phase) + ".bin";
+    }
+
+    // On a hit, makes dest_path hold the cached bitstream and returns true. dest_path is left
+    // untouched when it already holds the same bitstream, so a repeated hit writes nothing.
+    bool fetch(const std::string& key, const std::string& dest_path) const {
+        return enabled() && publish(entryPath(key), dest_path);
+    }
+
+    // Multi-phase lookup: on a hit, makes dest_path(p) hold phase p of the cached kernel for
+    // every phase and returns the number of phases (1 for a single configuration); 0 on a miss.
+    // Runs under lock(), so that eviction cannot remove some of the phases while they are read.
+    size_t fetchPhases(const std::string& key, const std::function<std::string(size_t)>& dest_path) const {
+        if (!enabled()) return 0;
+        PackedBitstream::Header header;
+        if (!readHeader(entryPath(key), header)) return 0;
+        Lock guard = lock();
+        // <key>.bin is written last, so once it exists every phase does
+        size_t num_phases = 1;
+        while (readHeader(phaseEntryPath(key, num_phases), header)) {
+            num_phases++;
+        }
+        for (size_t p = 0; p < num_phases; p++) {
+            if (!publish(phaseEntryPath(key, p), dest_path(p))) return 0;
+        }
+        return num_phases;
+    }
+
+    // Inserts a compiled bitstream and evicts beyond the size limit
+    void store(const std::string& key, const PackedBitstream& bitstream) const {
+        insert(key, &bitstream, 1);
+    }
+
+    // Inserts the phases of one kernel as one entry and evicts beyond the size limit
+    void storePhases(const std::string& key, const std::vector<PackedBitstream>& phases) const {
+        insert(key, phases.data(), phases.size());
+    }
+
+    // Removes least recently used entries until at most max_entries remain (call under lock())
+    void evict() const {
+        DIR* d = ::opendir(dir_.c_str());
+        if (!d) return;
+        std::vector<std::pair<int64_t, std::string>> entries;   // (mtime ns, path)
+        std::vector<std::string> phase_files;
+        while (struct dirent* e = ::readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() < 4 || name.compare(name.size() - 4, 4, ".bin") != 0) continue;
+            std::string path = dir_ + "/" + name;
+            if (name.find("_phase") != std::string::npos) {
+                phase_files.push_back(path);    // Goes with the <key>.bin of its kernel
+                continue;
+            }
+            struct stat st;
+            if (::stat(path.c_str(), &st) == 0) {
+                entries.emplace_back(static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, path);
+            }
+        }
+        ::closedir(d);
+
+        if (entries.size() <= max_entries_) return;
+        std::sort(entries.begin(), entries.end());
+        for (size_t i = 0; i < entries.size() - max_entries_; i++) {
+            const std::string& path = entries[i].second;
+            const std::string stem = path.substr(0, path.size() - 4);
+            std::remove(path.c_str());
+            for (const std::string& phase_file : phase_files) {
+                if (phase_file.compare(0, stem.size() + 6, stem + "_phase") == 0) {
+                    std::remove(phase_file.c_str());
+                }
+            }
+        }
+    }
+
+    // Removes every entry
+    void clear() const {
+        Lock guard = lock();
+        DODACompileCache empty(dir_, 0);
+        empty.evict();
+    }
+
+    // Exclusive lock on one key, or with an empty key on the whole cache (created on demand).
+    // flock() locks belong to the open file description, so this also excludes other threads.
+    class Lock {
+    public:
+        explicit Lock(int fd) : fd_(fd) {}
+        Lock(Lock&& other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
+        Lock(const Lock&) = delete;
+        Lock& operator=(const Lock&) = delete;
+        ~Lock() {
+            if (fd_ >= 0) {
+                ::flock(fd_, LOCK_UN);
+                ::close(fd_);
+            }
+        }
+    private:
+        int fd_;
+    };
+
+    Lock lock(const std::string& key = std::string()) const {
+        makeDirs(dir_);
+        const std::string path = key.empty() ? dir_ + "/.lock" : dir_ + "/" + key + ".lock";
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            while (::flock(fd, LOCK_EX) != 0 && errno == EINTR) {}
+        }
+        return Lock(fd);
+    }
+
+private:
+    std::string dir_;
+    size_t max_entries_;
+
+    // Writes phases 1, 2, ... first and phase 0 (the <key>.bin that lookups start from) last
+    void insert(const std::string& key, const PackedBitstream* phases, size_t num_phases) const {
+        if (!enabled() || num_phases == 0) return;
+        try {
+            for (size_t p = num_phases; p-- > 0; ) {
+                phases[p].writeBinary(phaseEntryPath(key, p));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: compile cache store failed: " << e.what() << std::endl;
+            return;
+        }
+        Lock guard = lock();
+        evict();
+    }
+
+    // Validates entry, refreshes its LRU position and makes dest_path hold it
+    bool publish(const std::string& entry, const std::string& dest_path) const {
+        PackedBitstream::Header entry_header;
+        if (!readHeader(entry, entry_header)) return false;
+        try {
+            PackedBitstream::map(entry);    // Validates size and checksum
+        } catch (const std::exception&) {
+            return false;
+        }
+
+        // Refresh LRU position (metadata only)
+        ::utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+
+        PackedBitstream::Header dest_header;
+        if (readHeader(dest_path, dest_header) && std::memcmp(&dest_header, &entry_header, sizeof(entry_header)) == 0) {
+            return true;
+        }
+
+        // Publish the entry at dest_path: hard link (or copy) to a temporary, then rename
+        const std::string tmp = dest_path + PackedBitstream::tempSuffix();
+        std::remove(tmp.c_str());
+        if (::link(entry.c_str(), tmp.c_str()) != 0) {
+            try {
+                PackedBitstream::map(entry).writeBinary(tmp);
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+        if (std::rename(tmp.c_str(), dest_path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static bool readHeader(const std::string& path, PackedBitstream::Header& header) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        const ssize_t n = ::read(fd, &header, sizeof(header));
+        ::close(fd);
+        return n == static_cast<ssize_t>(sizeof(header)) && header.magic == PackedBitstream::MAGIC;
+    }
+
+    static void makeDirs(const std::string& path) {
+        for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+            ::mkdir(path.substr(0, pos).c_str(), 0755);
+            if (pos == std::string::npos) break;
+        }
+    }
+};
+
+// The compile cache used by load_lambda
+inline DODACompileCache& doda_compile_cache() {
+    static DODACompileCache cache;
+    return cache;
+}
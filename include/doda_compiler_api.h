@@ -14,6 +14,7 @@ typedef enum {
     DODA_ERROR_FILE_NOT_FOUND = -2,
     DODA_ERROR_COMPILATION_FAILED = -3,
     DODA_ERROR_MEMORY_ALLOCATION = -4,
+    DODA_ERROR_BUFFER_TOO_SMALL = -5,
     DODA_ERROR_UNKNOWN = -99
 } doda_result_t;
 
@@ -27,6 +28,16 @@ typedef struct {
     size_t* cluster_sizes;   // Size of each cluster's instruction array
 } doda_bitstream_t;
 
+// Geometry of a packed bitstream written by doda_compile_dfg_buffer. Instructions are
+// cluster-major, words_per_instruction words each, bit 0 = LSB of the first word
+// (the payload layout of PackedBitstream / *_bitstream.bin)
+typedef struct {
+    size_t num_clusters;
+    size_t num_pe_per_cluster;
+    size_t words_per_instruction;
+    size_t num_words;        // num_clusters * num_pe_per_cluster * words_per_instruction
+} doda_packed_info_t;
+
 // Runtime metadata structure
 typedef struct {
     int input_size_bytes;
@@ -74,6 +85,79 @@ doda_result_t doda_compile_dfg(
     doda_runtime_metadata_t* metadata
 );
 
+/**
+ * Compile an in-memory DFG JSON to a packed bitstream in a caller-provided buffer
+ * @param handle Compiler context handle
+ * @param dfg_json DFG JSON text (need not be NUL-terminated)
+ * @param dfg_json_len Length of dfg_json in bytes
+ * @param metadata Runtime metadata (optional, can be NULL); input_size_bytes overrides the
+ *                 runtime_metadata block of the JSON
+ * @param words Output buffer (can be NULL to query the required size)
+ * @param capacity_words Capacity of words, in uint32_t words
+ * @param info Output geometry, also filled on DODA_ERROR_BUFFER_TOO_SMALL (optional, can be NULL)
+ * @return DODA_SUCCESS on success, DODA_ERROR_BUFFER_TOO_SMALL if words is NULL or too small,
+ *         error code on failure
+ */
+doda_result_t doda_compile_dfg_buffer(
+    doda_compiler_handle_t handle,
+    const char* dfg_json,
+    size_t dfg_json_len,
+    const doda_runtime_metadata_t* metadata,
+    uint32_t* words,
+    size_t capacity_words,
+    doda_packed_info_t* info
+);
+
+/**
+ * Compile an in-memory DFG JSON into one packed bitstream per configuration of the fabric. A DFG
+ * that needs more PEs than the fabric has is temporally partitioned (doda_mapper::construct_phases):
+ * phase p + 1 is programmed after phase p has run, on the SPM contents phase p left behind. A
+ * partitioned DFG is compiled with its tile length as loop bound.
+ * @param handle Compiler context handle
+ * @param dfg_json DFG JSON text (need not be NUL-terminated)
+ * @param dfg_json_len Length of dfg_json in bytes
+ * @param metadata Runtime metadata (optional, can be NULL), as for doda_compile_dfg_buffer
+ * @param words Output buffer for the phases' packed bitstreams, back to back (can be NULL to query the size)
+ * @param capacity_words Capacity of words, in uint32_t words
+ * @param info Output geometry of one phase (num_words is per phase), also filled on DODA_ERROR_BUFFER_TOO_SMALL
+ * @param num_phases Output number of phases, also set on DODA_ERROR_BUFFER_TOO_SMALL
+ * @return DODA_SUCCESS on success, DODA_ERROR_BUFFER_TOO_SMALL if words is NULL or too small,
+ *         error code on failure
+ */
+doda_result_t doda_compile_dfg_phases(
+    doda_compiler_handle_t handle,
+    const char* dfg_json,
+    size_t dfg_json_len,
+    const doda_runtime_metadata_t* metadata,
+    uint32_t* words,
+    size_t capacity_words,
+    doda_packed_info_t* info,
+    size_t* num_phases
+);
+
+/**
+ * Splice the DFGs of chained map kernels into one DFG JSON (doda_mapper::fuse_dfgs): the
+ * output of stage i feeds stage i+1 directly instead of going through the SPM
+ * @param handle Compiler context handle
+ * @param dfg_jsons DFG JSON texts of the stages, in execution order (need not be NUL-terminated)
+ * @param dfg_json_lens Length of each DFG JSON text in bytes
+ * @param num_stages Number of stages
+ * @param fused_json Output buffer (can be NULL to query the required size)
+ * @param capacity Capacity of fused_json in bytes
+ * @param fused_len Length of the fused JSON text, also set on DODA_ERROR_BUFFER_TOO_SMALL
+ * @return DODA_SUCCESS on success, DODA_ERROR_BUFFER_TOO_SMALL if fused_json is NULL or too small,
+ *         error code on failure
+ */
+doda_result_t doda_fuse_dfgs(
+    doda_compiler_handle_t handle,
+    const char* const* dfg_jsons,
+    const size_t* dfg_json_lens,
+    size_t num_stages,
+    char* fused_json,
+    size_t capacity,
+    size_t* fused_len
+);
+
 /**
  * Get the last error message from the compiler
  * @param handle Compiler context handle
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+// Batch entry point for an extracted lambda, compiled in the same translation unit as the
+// lambda so the per-element call is inlined and the loop can be vectorized. The build
+// generates one batch_lambda_N.cpp per lambda:
+//
+//   #include "lambda_N.cpp"
+//   #include <doda_lambda_batch.hpp>
+//   DODA_DEFINE_LAMBDA_BATCH(lambda_N)
+//
+// which exports lambda_N_batch(const uint32_t* input, uint32_t* output, size_t n). For a
+// lambda with K > 1 parameters (a multi-stream kernel), input holds the K input streams
+// back to back: parameter k of element i is input[k * n + i]. A lambda returning a
+// std::array<uint32_t, M> writes its M output streams back to back the same way: element m
+// of the result for element i is output[m * n + i].
+namespace doda_lambda_batch {
+
+inline void run(uint32_t (*fn)(uint32_t), const uint32_t* __restrict input, uint32_t* __restrict output, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        output[i] = fn(input[i]);
+    }
+}
+
+inline void store(uint32_t result, uint32_t* __restrict output, size_t /*n*/, size_t i) {
+    output[i] = result;
+}
+
+template<size_t M>
+inline void store(const std::array<uint32_t, M>& result, uint32_t* __restrict output, size_t n, size_t i) {
+    for (size_t m = 0; m < M; ++m) {
+        output[m * n + i] = result[m];
+    }
+}
+
+template<typename Result, typename... Args, size_t... K>
+inline void run_streams(Result (*fn)(Args...), const uint32_t* __restrict input, uint32_t* __restrict output,
+                        size_t n, std::index_sequence<K...>) {
+    for (size_t i = 0; i < n; ++i) {
+        store(fn(input[K * n + i]...), output, n, i);
+    }
+}
+
+template<typename Result, typename... Args>
+inline void run(Result (*fn)(Args...), const uint32_t* __restrict input, uint32_t* __restrict output, size_t n) {
+    run_streams(fn, input, output, n, std::index_sequence_for<Args...>());
+}
+
+}  // namespace doda_lambda_batch
+
+#define DODA_DEFINE_LAMBDA_BATCH(name)                                                          \
+    extern "C" void name##_batch(const uint32_t* __restrict input, uint32_t* __restrict output, \
+                                 size_t n) {                                                    \
+        doda_lambda_batch::run(name, input, output, n);                                         \
+    }
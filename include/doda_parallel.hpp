@@ -0,0 +1,156 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+// Persistent worker pool for data-parallel loops on the host (CPU execution path).
+//
+// parallelFor splits [0, n) into chunks of at least min_chunk elements and runs them on the
+// workers plus the calling thread. One loop runs at a time; a call from inside a loop body
+// runs serially instead of waiting on the pool. Workers are created on first use.
+class DODAThreadPool {
+public:
+    // num_threads == 0 uses $DODA_CPU_THREADS, else std::thread::hardware_concurrency()
+    explicit DODAThreadPool(unsigned num_threads = 0) {
+        if (num_threads == 0) {
+            const char* env = std::getenv("DODA_CPU_THREADS");
+            num_threads = env ? static_cast<unsigned>(std::strtoul(env, nullptr, 10)) : 0;
+        }
+        if (num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_threads_ = num_threads;
+    }
+
+    ~DODAThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    DODAThreadPool(const DODAThreadPool&) = delete;
+    DODAThreadPool& operator=(const DODAThreadPool&) = delete;
+
+    unsigned numThreads() const { return num_threads_; }
+
+    // body(begin, end) is called for disjoint ranges covering [0, n)
+    void parallelFor(size_t n, size_t min_chunk, const std::function<void(size_t, size_t)>& body) {
+        if (n == 0) return;
+        min_chunk = std::max<size_t>(1, min_chunk);
+        const size_t max_chunks = (n + min_chunk - 1) / min_chunk;
+        const size_t num_chunks = std::min<size_t>(max_chunks, num_threads_);
+        if (num_chunks <= 1 || inWorker()) {
+            body(0, n);
+            return;
+        }
+
+        std::lock_guard<std::mutex> loop_lock(loop_mutex_);
+        startWorkers();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            body_ = &body;
+            n_ = n;
+            num_chunks_ = num_chunks;
+            next_chunk_ = 0;
+            chunks_done_ = 0;
+            generation_++;
+        }
+        work_cv_.notify_all();
+
+        // The calling thread runs chunks too; a parallelFor from its chunks must run serially
+        // like one from a worker's, not wait on loop_mutex_ it already holds
+        {
+            InWorkerScope in_worker;
+            runChunks();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return chunks_done_ == num_chunks_; });
+        body_ = nullptr;
+    }
+
+private:
+    static bool& inWorker() {
+        static thread_local bool in_worker = false;
+        return in_worker;
+    }
+
+    struct InWorkerScope {
+        bool saved = inWorker();
+        InWorkerScope() { inWorker() = true; }
+        ~InWorkerScope() { inWorker() = saved; }
+    };
+
+    void startWorkers() {
+        if (!workers_.empty()) return;
+        for (unsigned i = 1; i < num_threads_; i++) {
+            workers_.emplace_back([this] {
+                inWorker() = true;
+                unsigned long seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        work_cv_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+                        if (stopping_) return;
+                        seen = generation_;
+                    }
+                    runChunks();
+                }
+            });
+        }
+    }
+
+    // Claims and runs chunks of the current loop until none are left
+    void runChunks() {
+        while (true) {
+            size_t chunk, num_chunks, n;
+            const std::function<void(size_t, size_t)>* body;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!body_ || next_chunk_ >= num_chunks_) return;
+                chunk = next_chunk_++;
+                num_chunks = num_chunks_;
+                n = n_;
+                body = body_;
+            }
+            (*body)(n * chunk / num_chunks, n * (chunk + 1) / num_chunks);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (++chunks_done_ == num_chunks_) done_cv_.notify_all();
+            }
+        }
+    }
+
+    unsigned num_threads_;
+    std::vector<std::thread> workers_;
+
+    std::mutex loop_mutex_;             // One parallelFor at a time
+    std::mutex mutex_;                  // Guards the loop state below
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(size_t, size_t)>* body_ = nullptr;
+    size_t n_ = 0;
+    size_t num_chunks_ = 0;
+    size_t next_chunk_ = 0;
+    size_t chunks_done_ = 0;
+    unsigned long generation_ = 0;
+    bool stopping_ = false;
+};
+
+// The pool used by the CPU execution path
+inline DODAThreadPool& doda_thread_pool() {
+    static DODAThreadPool pool;
+    return pool;
+}
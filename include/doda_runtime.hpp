@@ -10,11 +10,28 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <mutex>
+#include <cctype>
+#include <cstdlib>
+#include <array>
+#include <map>
+#include <utility>
+#include <tuple>
+#include <typeindex>
+#include <typeinfo>
+#include "doda_bitstream.hpp"
 #ifndef DODA_SIMULATION_MODE
+#include <thread>
+#include <atomic>
 #include "doda_compiler_api.h"
+#include "doda_parallel.hpp"
+#include "doda_compile_cache.hpp"
 #endif
 
 #ifdef DODA_SIMULATION_MODE
+#include <memory>
+#include <unordered_map>
 #include "doda_simulator.hpp"
 #endif
 
@@ -23,65 +40,200 @@
 // The function pointer type for compiled lambdas
 typedef uint32_t (*lambda_t)(uint32_t);
 
+// Batch entry point emitted next to each lambda (see doda_lambda_batch.hpp)
+typedef void (*lambda_batch_t)(const uint32_t*, uint32_t*, size_t);
+
+// Reduction operators of reduce_on_doda. MIN and MAX compare as unsigned 32-bit integers,
+// like the fabric's CLT/CGT (the DFG generator maps signed and unsigned compares alike).
+enum class DODAReduceOp { NONE, SUM, MIN, MAX, AND, OR, XOR };
+
 // Simple struct to keep run-time metadata
 struct RuntimeMetadata { 
     bool vector_size_check;  // Did runtime size check pass?
     int size_bytes;          // Size of data type in bytes
+    DODAReduceOp reduce_op = DODAReduceOp::NONE;    // Reduction kernel (reduce_on_doda)
+    int replicas = 1;        // Requested copies of a single-stream map, one per cluster
 };
 
+// Copies of a single-stream map kernel to request from the mapper (see doda_mapper::replica_count):
+// $DODA_REPLICAS, default one per cluster. The mapper places fewer when the kernel does not fit.
+inline int doda_map_replicas() {
+    static const int replicas = [] {
+        const char* env = std::getenv("DODA_REPLICAS");
+        return env ? std::max(1, std::atoi(env)) : 4;
+    }();
+    return replicas;
+}
+
+// Name of a reduction op in the DFG ("reduction": {"op": ...})
+inline const char* reduce_op_name(DODAReduceOp op) {
+    switch (op) {
+        case DODAReduceOp::SUM: return "sum";
+        case DODAReduceOp::MIN: return "min";
+        case DODAReduceOp::MAX: return "max";
+        case DODAReduceOp::AND: return "and";
+        case DODAReduceOp::OR: return "or";
+        case DODAReduceOp::XOR: return "xor";
+        default: return "none";
+    }
+}
+
+// Identity element of a reduction op
+inline uint32_t reduce_identity(DODAReduceOp op) {
+    switch (op) {
+        case DODAReduceOp::MIN: return 0xffffffffu;
+        case DODAReduceOp::MAX: return 0;
+        case DODAReduceOp::AND: return 0xffffffffu;
+        default: return 0;
+    }
+}
+
+inline uint32_t reduce_combine(DODAReduceOp op, uint32_t a, uint32_t b) {
+    switch (op) {
+        case DODAReduceOp::SUM: return a + b;
+        case DODAReduceOp::MIN: return b < a ? b : a;
+        case DODAReduceOp::MAX: return b > a ? b : a;
+        case DODAReduceOp::AND: return a & b;
+        case DODAReduceOp::OR: return a | b;
+        case DODAReduceOp::XOR: return a ^ b;
+        default: return b;
+    }
+}
+
+// Paths of the per-kernel artifacts under ./obj. A kernel is an extracted lambda ("lambda_N")
+// or a fused map chain ("fused_N_M...", see DODAMapChain).
+inline std::string lambda_kernel_name(int lambda_index) {
+    return "lambda_" + std::to_string(lambda_index);
+}
+
+inline std::string kernel_dfg_path(const std::string& kernel_name) {
+    return "./obj/" + kernel_name + "_dfg.json";
+}
+
+inline std::string kernel_bitstream_text_path(const std::string& kernel_name) {
+    return "./obj/" + kernel_name + "_bitstream.txt";
+}
+
+inline std::string kernel_bitstream_bin_path(const std::string& kernel_name) {
+    return "./obj/" + kernel_name + "_bitstream.bin";
+}
+
+// Bitstream of phase p of a temporally partitioned kernel; phase 0 is the kernel's bitstream
+inline std::string kernel_phase_bitstream_text_path(const std::string& kernel_name, int phase) {
+    return phase == 0 ? kernel_bitstream_text_path(kernel_name)
+                      : "./obj/" + kernel_name + "_phase" + std::to_string(phase) + "_bitstream.txt";
+}
+
+inline std::string kernel_phase_bitstream_bin_path(const std::string& kernel_name, int phase) {
+    return phase == 0 ? kernel_bitstream_bin_path(kernel_name)
+                      : "./obj/" + kernel_name + "_phase" + std::to_string(phase) + "_bitstream.bin";
+}
+
+inline std::string lambda_bitstream_text_path(int lambda_index) {
+    return kernel_bitstream_text_path(lambda_kernel_name(lambda_index));
+}
+
+inline std::string lambda_bitstream_bin_path(int lambda_index) {
+    return kernel_bitstream_bin_path(lambda_kernel_name(lambda_index));
+}
+
+// Returns the DFG JSON text with its reduction block added, updated or (for NONE) removed.
+// The accumulator starts from the op's identity, so one bitstream serves every tile and
+// every init value; reduce_on_doda folds init in on the host.
+inline std::string apply_reduction(std::string content, DODAReduceOp op) {
+    size_t reductionPos = content.find("\"reduction\"");
+    if (reductionPos != std::string::npos) {
+        // Remove the existing block together with the comma in front of it
+        size_t blockEnd = content.find('}', reductionPos) + 1;
+        size_t comma = content.find_last_not_of(" \t\n\r", reductionPos - 1);
+        size_t eraseStart = (comma != std::string::npos && content[comma] == ',') ? comma : reductionPos;
+        content.erase(eraseStart, blockEnd - eraseStart);
+    }
+    if (op == DODAReduceOp::NONE) {
+        return content;
+    }
+
+    size_t lastBrace = content.rfind('}');
+    if (lastBrace == std::string::npos) {
+        return content;
+    }
+    // Append the block right after the last content character, so the text that closes the
+    // object (whitespace and the final brace) stays behind it
+    size_t lastContentLine = content.find_last_not_of(" \t\n\r", lastBrace - 1);
+    if (lastContentLine != std::string::npos) {
+        std::string newReduction = std::string(",\n  \"reduction\": {\"op\": \"") + reduce_op_name(op) +
+                                   "\", \"init\": " + std::to_string(static_cast<int32_t>(reduce_identity(op))) + "}";
+        content.insert(lastContentLine + 1, newReduction);
+    }
+    return content;
+}
+
+// Returns the DFG JSON text with its runtime_metadata block added or updated, followed by the
+// reduction block. Applying the same metadata twice yields the same text.
+inline std::string apply_metadata(std::string content, const RuntimeMetadata& metadata) {
+    const std::string replicas = metadata.replicas > 1 ?
+        ",\n    \"replicas\": " + std::to_string(metadata.replicas) : std::string();
+
+    // Simple string-based modification to add/update metadata
+    // This is a basic implementation - in production, use a proper JSON library
+    
+    // Find the closing brace of the JSON
+    size_t lastBrace = content.rfind('}');
+    if (lastBrace != std::string::npos) {
+        // Check if metadata field exists
+        size_t metadataPos = content.find("\"runtime_metadata\"");
+        
+        if (metadataPos != std::string::npos) {
+            // Replace the existing metadata block
+            size_t metadataBlockStart = content.find('{', metadataPos);
+            size_t metadataBlockEnd = content.find('}', metadataBlockStart) + 1;
+            
+            // Create new metadata content
+            std::string newMetadata = "\"runtime_metadata\": {\n    \"input_size_in_bytes\": " + 
+                                     std::to_string(metadata.size_bytes) + ",\n    " +
+                                     "\"vector_size_checked\": " + 
+                                     (metadata.vector_size_check ? "true" : "false") + replicas + "\n  }";
+            
+            // Replace existing metadata with new content
+            content.replace(metadataPos, metadataBlockEnd - metadataPos, newMetadata);
+        } else {
+            // Add metadata if it doesn't exist by appending to the last line with content
+
+            // Find the last content line (ignoring whitespace lines at the end)
+            size_t lastContentLine = content.find_last_not_of(" \t\n\r", lastBrace - 1);
+            if (lastContentLine != std::string::npos) {
+                // Insert a comma right after the last content character, then the metadata on new
+                // lines, in front of the whitespace and brace that close the object
+                std::string newMetadata = ",\n  \"runtime_metadata\": {\n    \"input_size_in_bytes\": " + 
+                                        std::to_string(metadata.size_bytes) + ",\n    " +
+                                        "\"vector_size_checked\": " + 
+                                        (metadata.vector_size_check ? "true" : "false") + replicas + "\n  }";
+    
+                content.insert(lastContentLine + 1, newMetadata);
+            }
+        }
+    }
+    // The reduction block goes last, so that a second application removes and re-adds it in place
+    return apply_reduction(content, metadata.reduce_op);
+}
+
+inline std::string read_text_file(const std::string& path) {
+    std::ifstream inFile(path);
+    return std::string((std::istreambuf_iterator<char>(inFile)),
+                       std::istreambuf_iterator<char>());
+}
+
 // Function to add metadata to DFG file
 inline void add_metadata(const std::string& dfg_path, const RuntimeMetadata& metadata) {
     try {
         // Read the existing DFG file
-        std::ifstream inFile(dfg_path);
-        std::string content((std::istreambuf_iterator<char>(inFile)),
-                            std::istreambuf_iterator<char>());
-        inFile.close();
+        std::string content = read_text_file(dfg_path);
+        std::string updated = apply_metadata(content, metadata);
         
-        // Simple string-based modification to add/update metadata
-        // This is a basic implementation - in production, use a proper JSON library
-        
-        // Find the closing brace of the JSON
-        size_t lastBrace = content.rfind('}');
-        if (lastBrace != std::string::npos) {
-            // Check if metadata field exists
-            size_t metadataPos = content.find("\"runtime_metadata\"");
-            
-            if (metadataPos != std::string::npos) {
-                // Replace the existing metadata block
-                size_t metadataBlockStart = content.find('{', metadataPos);
-                size_t metadataBlockEnd = content.find('}', metadataBlockStart) + 1;
-                
-                // Create new metadata content
-                std::string newMetadata = "\"runtime_metadata\": {\n    \"input_size_in_bytes\": " + 
-                                         std::to_string(metadata.size_bytes) + ",\n    " +
-                                         "\"vector_size_checked\": " + 
-                                         (metadata.vector_size_check ? "true" : "false") + "\n  }";
-                
-                // Replace existing metadata with new content
-                content.replace(metadataPos, metadataBlockEnd - metadataPos, newMetadata);
-            } else {
-                // Add metadata if it doesn't exist by appending to the last line with content
-    
-                // Find the last content line (ignoring whitespace lines at the end)
-                size_t lastContentLine = content.find_last_not_of(" \t\n\r", lastBrace - 1);
-                if (lastContentLine != std::string::npos) {
-                    // Insert a comma right after the last content character
-                    content.insert(lastContentLine + 1, ",");
-        
-                    // Then add the metadata on new lines
-                    std::string newMetadata = "\n  \"runtime_metadata\": {\n    \"input_size_in_bytes\": " + 
-                                            std::to_string(metadata.size_bytes) + ",\n    " +
-                                            "\"vector_size_checked\": " + 
-                                            (metadata.vector_size_check ? "true" : "false") + "\n  }";
-        
-                    content.insert(lastBrace, newMetadata);
-                }
-            }
-            
-            // Write the updated content back to the file
+        // Write the updated content back to the file (only if something changed)
+        if (updated != content) {
             std::ofstream outFile(dfg_path);
-            outFile << content;
+            outFile << updated;
             outFile.close();
         }
     } catch (const std::exception& e) {
@@ -89,6 +241,139 @@ inline void add_metadata(const std::string& dfg_path, const RuntimeMetadata& met
     }
 }
 
+// One entry of the extraction manifest: "lambda_<N> [<file>:<line>[:<column>]]"
+struct LambdaManifestEntry {
+    int index;
+    std::string file;   // Call-site file, empty if the manifest has no location
+    int line;           // Call-site line, 0 if unknown
+};
+
+inline std::vector<LambdaManifestEntry> read_lambda_manifest_entries(const std::string& manifest_path = "./obj/lambda_manifest.txt") {
+    std::vector<LambdaManifestEntry> entries;
+    std::ifstream manifest(manifest_path);
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::istringstream fields(line);
+        std::string name, location;
+        fields >> name >> location;
+        if (name.compare(0, 7, "lambda_") != 0 || name.size() == 7 ||
+            name.find_first_not_of("0123456789", 7) != std::string::npos) {
+            continue;
+        }
+
+        LambdaManifestEntry entry;
+        entry.index = std::stoi(name.substr(7));
+        entry.line = 0;
+        // <file>:<line>[:<column>]
+        size_t colon = location.find(':');
+        if (colon != std::string::npos && colon + 1 < location.size() &&
+            std::isdigit(static_cast<unsigned char>(location[colon + 1]))) {
+            entry.file = location.substr(0, colon);
+            entry.line = std::atoi(location.c_str() + colon + 1);
+        }
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// Lambda indices listed in the extraction manifest, without duplicates
+inline std::vector<int> read_lambda_manifest(const std::string& manifest_path = "./obj/lambda_manifest.txt") {
+    std::vector<int> indices;
+    for (const LambdaManifestEntry& entry : read_lambda_manifest_entries(manifest_path)) {
+        if (std::find(indices.begin(), indices.end(), entry.index) == indices.end()) {
+            indices.push_back(entry.index);
+        }
+    }
+    return indices;
+}
+
+inline std::string path_basename(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Resolves a map_on_doda call site to its lambda index: the manifest entry recorded for the
+// same file and line if there is one, otherwise the next index in first-call order (the
+// numbering of a manifest without locations), skipping indices claimed by located entries.
+// The index is resolved once per call site and reused by every later call from it, including
+// calls from inside a loop. A site is the closure type together with the file and line, so
+// one lambda object passed at two sites (say to map_on_doda and reduce_on_doda) gets two
+// kernels, and so do two lambdas passed through one generic helper. Distinct closure types
+// at one location take that location's manifest entries in first-call order.
+inline int lambda_call_site_index(std::type_index closure, const char* call_file, int call_line) {
+    static std::mutex mutex;
+    static bool manifest_loaded = false;
+    static std::vector<LambdaManifestEntry> manifest;
+    static std::map<std::tuple<std::type_index, std::string, int>, int> call_sites;
+    static std::map<std::pair<std::string, int>, size_t> closures_at;   // Closure types seen per location
+    static int next_index = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const std::tuple<std::type_index, std::string, int> site(closure, call_file ? call_file : "", call_line);
+    auto found = call_sites.find(site);
+    if (found != call_sites.end()) {
+        return found->second;
+    }
+    if (!manifest_loaded) {
+        manifest = read_lambda_manifest_entries();
+        manifest_loaded = true;
+    }
+    const std::string file = path_basename(std::get<1>(site));
+    size_t skip = closures_at[std::make_pair(std::get<1>(site), call_line)]++;
+    for (const LambdaManifestEntry& entry : manifest) {
+        if (entry.line == call_line && path_basename(entry.file) == file && skip-- == 0) {
+            return call_sites[site] = entry.index;
+        }
+    }
+    auto claimed = [&](int index) {
+        for (const LambdaManifestEntry& entry : manifest) {
+            if (entry.index == index && entry.line > 0) return true;
+        }
+        return false;
+    };
+    while (claimed(next_index)) next_index++;
+    return call_sites[site] = next_index++;
+}
+
+template<typename Func>
+inline int lambda_call_site_index(const char* call_file, int call_line) {
+    return lambda_call_site_index(std::type_index(typeid(Func)), call_file, call_line);
+}
+
+// Deferred map_on_doda calls over one vector. map_on_doda(f, chain) only records the call
+// site's kernel; run(output) executes the recorded stages as one fused kernel, so intermediate
+// results go straight from one stage's nodes to the next instead of through an SPM readback
+// and reload per stage.
+//
+//   DODAMapChain chain(input);
+//   map_on_doda([](uint32_t x) { return x > 10 ? x : 0; }, chain);
+//   map_on_doda([](uint32_t x) { return x * 3; }, chain);
+//   chain.run(output);
+class DODAMapChain {
+public:
+    explicit DODAMapChain(const std::vector<uint32_t>& input) : input_(&input) {}
+
+    void record(int lambda_index) { stages_.push_back(lambda_index); }
+    const std::vector<uint32_t>& input() const { return *input_; }
+    const std::vector<int>& stages() const { return stages_; }
+
+    // Name of the fused kernel's artifacts under ./obj, e.g. "fused_0_1"
+    static std::string kernelName(const std::vector<int>& stages) {
+        std::string name = "fused";
+        for (int lambda_index : stages) {
+            name += "_" + std::to_string(lambda_index);
+        }
+        return name;
+    }
+
+    // Executes the recorded stages into output (which may be the input vector) and clears them
+    void run(std::vector<uint32_t>& output);
+
+private:
+    const std::vector<uint32_t>* input_;
+    std::vector<int> stages_;
+};
+
 #ifndef DODA_SIMULATION_MODE
 // Function to extract lambdas from source if needed
 inline void ensure_lambdas_extracted() {
@@ -109,39 +394,79 @@ inline void ensure_lambdas_extracted() {
     extraction_done = true;
 }
 
-// Dynamically loads a pre-compiled lambda in a shared library by index and returns the function pointer
-inline lambda_t load_lambda(int lambda_index, RuntimeMetadata& metadata) {
-    // Ensure lambda extraction has been performed
-    ensure_lambdas_extracted();
-    
-    // Setup DFG path
-    std::string dfg_path = "./obj/lambda_" + std::to_string(lambda_index) + "_dfg.json";
+// doda_compile_dfg_buffer is exported by libdoda_compiler_api.so (src/compiler); fall back to the
+// file-based doda_compile_dfg of libdoda_c_api.so when that library is not linked
+#pragma weak doda_compile_dfg_buffer
 
-    // Load shared library
-    const char* so_path = "./obj/liblambda.so";
-    void* handle = dlopen(so_path, RTLD_LAZY);
-    assert(handle && "Failed to load liblambda.so");
+// Compiles DFG text straight into a packed bitstream
+inline bool compile_dfg_buffer(doda_compiler_handle_t compiler, const std::string& dfg_text,
+                               const doda_runtime_metadata_t* metadata, PackedBitstream& packed) {
+    doda_packed_info_t info;
+    doda_result_t result = doda_compile_dfg_buffer(compiler, dfg_text.data(), dfg_text.size(), metadata,
+                                                   nullptr, 0, &info);
+    if (result != DODA_ERROR_BUFFER_TOO_SMALL ||
+        info.words_per_instruction != static_cast<size_t>(PackedBitstream::WORDS_PER_INSTRUCTION)) {
+        return false;
+    }
 
-    // Get lambda function
-    std::string symbol_name = "lambda_" + std::to_string(lambda_index);
-    lambda_t f = (lambda_t)dlsym(handle, symbol_name.c_str());
-    assert(f && ("Failed to find symbol '" + symbol_name).c_str());
+    packed = PackedBitstream(static_cast<int>(info.num_clusters), static_cast<int>(info.num_pe_per_cluster));
+    result = doda_compile_dfg_buffer(compiler, dfg_text.data(), dfg_text.size(), metadata,
+                                     packed.mutableInstruction(0, 0), packed.sizeWords(), &info);
+    return result == DODA_SUCCESS;
+}
 
-    // Update the DFG with the run-time metadata
-    add_metadata(dfg_path, metadata);
+// doda_compile_dfg_phases is exported by libdoda_compiler_api.so (src/compiler); without it a
+// DFG is compiled into a single configuration
+#pragma weak doda_compile_dfg_phases
 
-    // DODA compiler (shared library) augments the DFG and generates the bitstream for DODA
-    doda_compiler_handle_t compiler = doda_compiler_init();
-    assert(compiler && "Failed to initialize DODA compiler");
-    
+// Compiles DFG text into one packed bitstream per phase (a single one unless the DFG needs more
+// PEs than the fabric has)
+inline bool compile_dfg_phases(doda_compiler_handle_t compiler, const std::string& dfg_text,
+                               const doda_runtime_metadata_t* metadata, std::vector<PackedBitstream>& phases) {
+    doda_packed_info_t info;
+    size_t num_phases = 0;
+    doda_result_t result = doda_compile_dfg_phases(compiler, dfg_text.data(), dfg_text.size(), metadata,
+                                                   nullptr, 0, &info, &num_phases);
+    if (result != DODA_ERROR_BUFFER_TOO_SMALL || num_phases == 0 ||
+        info.words_per_instruction != static_cast<size_t>(PackedBitstream::WORDS_PER_INSTRUCTION)) {
+        return false;
+    }
+
+    std::vector<uint32_t> words(info.num_words * num_phases);
+    result = doda_compile_dfg_phases(compiler, dfg_text.data(), dfg_text.size(), metadata,
+                                     words.data(), words.size(), &info, &num_phases);
+    if (result != DODA_SUCCESS) {
+        return false;
+    }
+    phases.clear();
+    for (size_t p = 0; p < num_phases; p++) {
+        PackedBitstream packed(static_cast<int>(info.num_clusters), static_cast<int>(info.num_pe_per_cluster));
+        std::copy(words.begin() + p * info.num_words, words.begin() + (p + 1) * info.num_words,
+                  packed.mutableInstruction(0, 0));
+        phases.push_back(std::move(packed));
+    }
+    return true;
+}
+
+// Removes the bitstream files of a kernel's phases from first on, left over from an earlier compile
+inline void remove_kernel_phases(const std::string& kernel_name, int first) {
+    for (int p = first; access(kernel_phase_bitstream_bin_path(kernel_name, p).c_str(), F_OK) == 0 ||
+                        access(kernel_phase_bitstream_text_path(kernel_name, p).c_str(), F_OK) == 0; p++) {
+        std::remove(kernel_phase_bitstream_bin_path(kernel_name, p).c_str());
+        std::remove(kernel_phase_bitstream_text_path(kernel_name, p).c_str());
+    }
+}
+
+// Compiles a DFG file through the string-based API. Libraries without doda_compile_dfg_buffer
+// assign PE indices from process-global mapper state, so these compiles are serialized.
+inline bool compile_dfg_file(doda_compiler_handle_t compiler, const std::string& dfg_path, PackedBitstream& packed) {
+    static std::mutex global_mapper_mutex;
+    std::unique_lock<std::mutex> lock(global_mapper_mutex);
     doda_bitstream_t bitstream_data;
     doda_runtime_metadata_t doda_metadata;
     doda_result_t result = doda_compile_dfg(compiler, dfg_path.c_str(), &bitstream_data, &doda_metadata);
-    
     if (result != DODA_SUCCESS) {
-        std::cerr << "DODA compilation failed: " << doda_get_last_error(compiler) << std::endl;
-        doda_compiler_cleanup(compiler);
-        assert(false && "DODA compilation failed");
+        return false;
     }
 
     // Convert C bitstream to C++ format for compatibility
@@ -154,146 +479,989 @@ inline lambda_t load_lambda(int lambda_index, RuntimeMetadata& metadata) {
         std::stringstream ss(cluster_str);
         std::string instruction;
         while (std::getline(ss, instruction)) {
-            cluster_instructions.push_back(instruction);
-        }
-        bitstream.push_back(cluster_instructions);
-    }
-
-    // Generate the bitstream file
-    std::string bitstream_path = "./obj/lambda_" + std::to_string(lambda_index) + "_bitstream.txt";
-    std::ofstream out(bitstream_path);
-    
-    for (int cluster = 0; cluster < bitstream.size(); cluster++) {
-        out << "# Cluster " << cluster << " bitstream\n";
-        for (int pe = 0; pe < bitstream[cluster].size(); pe++) {
-            std::string instruction = bitstream[cluster][pe];
             // Remove PE#: prefix if present to get raw binary string
             size_t colon_pos = instruction.find(": ");
             if (colon_pos != std::string::npos) {
                 instruction = instruction.substr(colon_pos + 2);
             }
-            out << instruction << "\n";
+            cluster_instructions.push_back(instruction);
         }
-        out << "\n";
+        bitstream.push_back(cluster_instructions);
     }
-    out.close();
-
-    // Clean up shared library resources
     doda_free_bitstream(&bitstream_data);
+    lock.unlock();
+
+    try {
+        packed = PackedBitstream::fromText(bitstream);
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] Invalid bitstream from DODA compiler: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Produces ./obj/<kernel>_bitstream.{bin,txt} from the compile cache or by compiling dfg_content,
+// the text of ./obj/<kernel>_dfg.json. metadata == nullptr compiles the DFG as it is. Safe to call
+// from several threads; each call uses its own compiler context.
+inline bool compile_kernel_bitstream(const std::string& kernel_name, const std::string& dfg_content,
+                                     const RuntimeMetadata* metadata) {
+    const std::string dfg_path = kernel_dfg_path(kernel_name);
+    auto phase_path = [&kernel_name](size_t p) { return kernel_phase_bitstream_bin_path(kernel_name, static_cast<int>(p)); };
+
+    // Look up the compile cache by the DFG content (with run-time metadata) and compiler version.
+    // On a hit the bitstream is reused as-is: no DFG rewrite and no compiler invocation.
+    DODACompileCache& cache = doda_compile_cache();
+    const std::string dfg_with_metadata = metadata ? apply_metadata(dfg_content, *metadata) : dfg_content;
+    const std::string cache_key = DODACompileCache::makeKey(dfg_with_metadata, doda_get_version());
+    if (const size_t cached_phases = cache.fetchPhases(cache_key, phase_path)) {
+        remove_kernel_phases(kernel_name, static_cast<int>(cached_phases));
+        return true;
+    }
+
+    // Miss: serialize concurrent compiles of the same key and re-check under the lock
+    DODACompileCache::Lock key_lock = cache.lock(cache_key);
+    if (const size_t cached_phases = cache.fetchPhases(cache_key, phase_path)) {
+        remove_kernel_phases(kernel_name, static_cast<int>(cached_phases));
+        return true;
+    }
+
+    // DODA compiler (shared library) augments the DFG and generates the bitstream for DODA
+    doda_compiler_handle_t compiler = doda_compiler_init();
+    if (!compiler) {
+        std::cerr << "Failed to initialize DODA compiler" << std::endl;
+        return false;
+    }
+
+    std::vector<PackedBitstream> phases(1);
+    PackedBitstream& packed = phases[0];
+    bool compiled = false;
+    doda_runtime_metadata_t doda_metadata;
+    if (metadata) {
+        doda_metadata.input_size_bytes = metadata->size_bytes;
+        doda_metadata.input_size_elements = metadata->size_bytes / static_cast<int>(sizeof(uint32_t));
+        doda_metadata.vector_size_check_passed = metadata->vector_size_check ? 1 : 0;
+    }
+    if (doda_compile_dfg_phases != nullptr) {
+        // In-memory path that can split a DFG larger than the fabric into several configurations
+        compiled = compile_dfg_phases(compiler, dfg_with_metadata, metadata ? &doda_metadata : nullptr, phases);
+    } else if (doda_compile_dfg_buffer != nullptr) {
+        // In-memory path: DFG text in, packed words out, no DFG rewrite or string splitting
+        compiled = compile_dfg_buffer(compiler, dfg_with_metadata, metadata ? &doda_metadata : nullptr, packed);
+    } else {
+        // Update the DFG with the run-time metadata (only rewritten if it changed)
+        if (dfg_with_metadata != dfg_content) {
+            std::ofstream outFile(dfg_path);
+            outFile << dfg_with_metadata;
+        }
+        compiled = compile_dfg_file(compiler, dfg_path, packed);
+    }
+
+    if (!compiled) {
+        std::cerr << "DODA compilation of " << kernel_name << " failed: "
+                  << doda_get_last_error(compiler) << std::endl;
+        doda_compiler_cleanup(compiler);
+        return false;
+    }
+    doda_compiler_cleanup(compiler);
+
+    // Generate the bitstream files: packed binary (loaded by the simulator) and text (for debugging),
+    // one pair per phase. All phases of a kernel go into one cache entry.
+    try {
+        remove_kernel_phases(kernel_name, static_cast<int>(phases.size()));
+        for (size_t p = 0; p < phases.size(); p++) {
+            phases[p].writeBinary(kernel_phase_bitstream_bin_path(kernel_name, static_cast<int>(p)));
+            phases[p].writeText(kernel_phase_bitstream_text_path(kernel_name, static_cast<int>(p)));
+        }
+        cache.storePhases(cache_key, phases);
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] Failed to write bitstream for " << kernel_name << ": " << e.what() << std::endl;
+    }
+    return true;
+}
+
+// Produces ./obj/lambda_N_bitstream.{bin,txt} for one lambda from its extracted DFG
+inline bool compile_lambda_bitstream(int lambda_index, const RuntimeMetadata* metadata) {
+    const std::string kernel_name = lambda_kernel_name(lambda_index);
+    return compile_kernel_bitstream(kernel_name, read_text_file(kernel_dfg_path(kernel_name)), metadata);
+}
+
+// doda_fuse_dfgs is exported by libdoda_compiler_api.so (src/compiler)
+#pragma weak doda_fuse_dfgs
+
+// Splices the DFGs of a map chain into ./obj/<kernel>_dfg.json (rewritten only if it changed) and
+// returns its text in fused. Returns false if the linked compiler library cannot fuse DFGs.
+inline bool fuse_lambda_dfgs(const std::vector<int>& stages, const std::string& kernel_name, std::string& fused) {
+    if (doda_fuse_dfgs == nullptr) {
+        std::cerr << "[WARNING] libdoda_compiler_api.so is not linked, so " << kernel_name
+                  << " is not fused; its stages get one bitstream each" << std::endl;
+        return false;
+    }
+    std::vector<std::string> texts;
+    std::vector<const char*> text_ptrs;
+    std::vector<size_t> text_lens;
+    for (int lambda_index : stages) {
+        texts.push_back(read_text_file(kernel_dfg_path(lambda_kernel_name(lambda_index))));
+    }
+    for (const std::string& text : texts) {
+        text_ptrs.push_back(text.data());
+        text_lens.push_back(text.size());
+    }
+
+    doda_compiler_handle_t compiler = doda_compiler_init();
+    if (!compiler) {
+        std::cerr << "Failed to initialize DODA compiler" << std::endl;
+        return false;
+    }
+    size_t fused_len = 0;
+    doda_result_t result = doda_fuse_dfgs(compiler, text_ptrs.data(), text_lens.data(), stages.size(),
+                                          nullptr, 0, &fused_len);
+    if (result == DODA_ERROR_BUFFER_TOO_SMALL) {
+        fused.resize(fused_len);
+        result = doda_fuse_dfgs(compiler, text_ptrs.data(), text_lens.data(), stages.size(),
+                                &fused[0], fused.size(), &fused_len);
+    }
+    if (result != DODA_SUCCESS) {
+        std::cerr << "Fusing the DFGs of " << kernel_name << " failed: " << doda_get_last_error(compiler) << std::endl;
+        doda_compiler_cleanup(compiler);
+        return false;
+    }
     doda_compiler_cleanup(compiler);
+    fused.resize(fused_len);
+
+    const std::string dfg_path = kernel_dfg_path(kernel_name);
+    if (read_text_file(dfg_path) != fused) {
+        std::ofstream outFile(dfg_path);
+        outFile << fused;
+    }
+    return true;
+}
 
-    return f;
+// Produces the bitstream of a fused map chain. Returns false if the DFGs could not be fused.
+inline bool compile_fused_bitstream(const std::vector<int>& stages, const std::string& kernel_name,
+                                    const RuntimeMetadata* metadata) {
+    std::string fused;
+    return fuse_lambda_dfgs(stages, kernel_name, fused) && compile_kernel_bitstream(kernel_name, fused, metadata);
+}
+
+// Compiles the bitstreams of several lambdas ahead of their first call, on num_threads workers
+// (0 = hardware concurrency), so startup no longer compiles one kernel after another. With
+// metadata, the later load_lambda calls with the same metadata are compile-cache hits.
+// Returns the number of lambdas whose bitstream is available.
+inline size_t compile_lambdas(const std::vector<int>& lambda_indices, const RuntimeMetadata* metadata = nullptr,
+                              unsigned num_threads = 0) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, lambda_indices.size()));
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> compiled(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < lambda_indices.size(); i = next++) {
+            if (compile_lambda_bitstream(lambda_indices[i], metadata)) compiled++;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < num_threads; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& w : workers) {
+        w.join();
+    }
+    return compiled.load();
+}
+
+// Compiles every lambda listed in the extraction manifest
+inline size_t compile_lambda_manifest(const RuntimeMetadata* metadata = nullptr, unsigned num_threads = 0,
+                                      const std::string& manifest_path = "./obj/lambda_manifest.txt") {
+    return compile_lambdas(read_lambda_manifest(manifest_path), metadata, num_threads);
+}
+
+// Process-wide table of the extracted lambdas. liblambda.so is opened once and every lambda
+// listed in the manifest is resolved up front; lambdas missing from the manifest are resolved
+// on first use. Each entry also remembers the metadata its bitstream was last produced for,
+// so a repeated call is a table lookup.
+class DODAKernelRegistry {
+public:
+    struct Kernel {
+        lambda_t fn = nullptr;
+        lambda_batch_t batch = nullptr;     // nullptr if the library has no batch entry point
+        int compiled_size_bytes = -1;       // Metadata of the current bitstream (-1 = none yet)
+        DODAReduceOp compiled_reduce_op = DODAReduceOp::NONE;
+        int compiled_replicas = 1;
+
+        bool compiledFor(const RuntimeMetadata& metadata) const {
+            return compiled_size_bytes == metadata.size_bytes && compiled_reduce_op == metadata.reduce_op &&
+                   compiled_replicas == metadata.replicas;
+        }
+        void setCompiled(const RuntimeMetadata& metadata) {
+            compiled_size_bytes = metadata.size_bytes;
+            compiled_reduce_op = metadata.reduce_op;
+            compiled_replicas = metadata.replicas;
+        }
+    };
+
+    explicit DODAKernelRegistry(const std::string& library_path = "./obj/liblambda.so",
+                                const std::string& manifest_path = "./obj/lambda_manifest.txt") {
+        ensure_lambdas_extracted();
+        handle_ = dlopen(library_path.c_str(), RTLD_LAZY);
+        if (!handle_) {
+            std::cerr << "[ERROR] Failed to load " << library_path << ": " << dlerror() << std::endl;
+            return;
+        }
+        for (int index : read_lambda_manifest(manifest_path)) {
+            resolve(index);
+        }
+    }
+    ~DODAKernelRegistry() {
+        if (handle_) dlclose(handle_);
+    }
+
+    DODAKernelRegistry(const DODAKernelRegistry&) = delete;
+    DODAKernelRegistry& operator=(const DODAKernelRegistry&) = delete;
+
+    // Returns the kernel, producing its bitstream first if it was not produced for this metadata
+    Kernel get(int lambda_index, const RuntimeMetadata& metadata) {
+        Kernel kernel;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            kernel = resolve(lambda_index);
+            if (kernel.compiledFor(metadata)) {
+                return kernel;
+            }
+        }
+
+        // Compile outside the lock; concurrent compiles of one key are serialized by the compile cache
+        if (!compile_lambda_bitstream(lambda_index, &metadata)) {
+            return kernel;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        kernels_[lambda_index].setCompiled(metadata);
+        kernel.setCompiled(metadata);
+        return kernel;
+    }
+
+    // Returns the kernel's functions without producing a bitstream
+    Kernel lookup(int lambda_index) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return resolve(lambda_index);
+    }
+
+    // Produces the fused bitstream of a map chain for metadata. Returns false if the stages
+    // could not be fused.
+    bool getFused(const std::vector<int>& stages, const RuntimeMetadata& metadata) {
+        const std::string kernel_name = DODAMapChain::kernelName(stages);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = fused_.find(kernel_name);
+            if (it != fused_.end() && it->second.compiledFor(metadata)) {
+                return true;
+            }
+        }
+
+        if (!compile_fused_bitstream(stages, kernel_name, &metadata)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        fused_[kernel_name].setCompiled(metadata);
+        return true;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return kernels_.size();
+    }
+
+private:
+    // Looks up (and on first use resolves) a table entry; call with mutex_ held
+    Kernel resolve(int lambda_index) {
+        if (lambda_index < 0) return Kernel();
+        if (static_cast<size_t>(lambda_index) >= kernels_.size()) {
+            kernels_.resize(lambda_index + 1);
+            resolved_.resize(lambda_index + 1, false);
+        }
+        if (!resolved_[lambda_index] && handle_) {
+            std::string symbol_name = "lambda_" + std::to_string(lambda_index);
+            kernels_[lambda_index].fn = (lambda_t)dlsym(handle_, symbol_name.c_str());
+            kernels_[lambda_index].batch = (lambda_batch_t)dlsym(handle_, (symbol_name + "_batch").c_str());
+            resolved_[lambda_index] = true;
+        }
+        return kernels_[lambda_index];
+    }
+
+    mutable std::mutex mutex_;
+    void* handle_ = nullptr;
+    std::vector<Kernel> kernels_;           // Indexed by lambda index
+    std::vector<bool> resolved_;
+    std::map<std::string, Kernel> fused_;   // Fused map chains by kernel name (bitstream state only)
+};
+
+// The kernel registry used by map_on_doda
+inline DODAKernelRegistry& doda_kernel_registry() {
+    static DODAKernelRegistry registry;
+    return registry;
+}
+
+// Returns the function pointer of a pre-compiled lambda and produces its bitstream for metadata
+inline lambda_t load_lambda(int lambda_index, RuntimeMetadata& metadata) {
+    DODAKernelRegistry::Kernel kernel = doda_kernel_registry().get(lambda_index, metadata);
+    assert(kernel.fn && "Failed to find lambda symbol in liblambda.so");
+    assert(kernel.compiledFor(metadata) && "DODA compilation failed");
+    return kernel.fn;
+}
+
+// Runs a loaded lambda over n elements, through its batch entry point when there is one.
+// Large inputs are split across the CPU thread pool.
+inline void run_lambda_on_cpu(lambda_t f, lambda_batch_t batch, const uint32_t* input, uint32_t* output, size_t n) {
+    const size_t min_chunk = 1 << 15;   // Elements per task; smaller inputs run on the calling thread
+    doda_thread_pool().parallelFor(n, min_chunk, [=](size_t begin, size_t end) {
+        if (batch) {
+            batch(input + begin, output + begin, end - begin);
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                output[i] = f(input[i]);
+            }
+        }
+    });
+}
+
+// Maps a loaded lambda over n elements and reduces the results into init. Each task maps a
+// block at a time through the batch entry point and folds it into a private partial result.
+inline uint32_t reduce_lambda_on_cpu(DODAReduceOp op, uint32_t init, lambda_t f, lambda_batch_t batch,
+                                     const uint32_t* input, size_t n) {
+    const size_t min_chunk = 1 << 15;
+    const size_t block_size = 1024;
+    std::mutex result_mutex;
+    uint32_t result = init;
+    doda_thread_pool().parallelFor(n, min_chunk, [&](size_t begin, size_t end) {
+        uint32_t block[block_size];
+        uint32_t partial = reduce_identity(op);
+        for (size_t offset = begin; offset < end; offset += block_size) {
+            const size_t len = std::min(block_size, end - offset);
+            if (batch) {
+                batch(input + offset, block, len);
+            } else {
+                for (size_t i = 0; i < len; ++i) {
+                    block[i] = f(input[offset + i]);
+                }
+            }
+            for (size_t i = 0; i < len; ++i) {
+                partial = reduce_combine(op, partial, block[i]);
+            }
+        }
+        std::lock_guard<std::mutex> lock(result_mutex);
+        result = reduce_combine(op, result, partial);
+    });
+    return result;
+}
+
+// Runs a chain of loaded lambdas over n elements a block at a time, so the intermediate results
+// of a block stay in cache. input and output may alias.
+inline void run_lambda_chain_on_cpu(const std::vector<DODAKernelRegistry::Kernel>& kernels,
+                                    const uint32_t* input, uint32_t* output, size_t n) {
+    const size_t min_chunk = 1 << 15;
+    const size_t block_size = 1024;
+    doda_thread_pool().parallelFor(n, min_chunk, [&](size_t begin, size_t end) {
+        uint32_t blocks[2][block_size];
+        for (size_t offset = begin; offset < end; offset += block_size) {
+            const size_t len = std::min(block_size, end - offset);
+            const uint32_t* src = input + offset;
+            for (size_t k = 0; k < kernels.size(); ++k) {
+                uint32_t* dst = blocks[k % 2];
+                if (kernels[k].batch) {
+                    kernels[k].batch(src, dst, len);
+                } else {
+                    for (size_t i = 0; i < len; ++i) {
+                        dst[i] = kernels[k].fn(src[i]);
+                    }
+                }
+                src = dst;
+            }
+            std::copy(src, src + len, output + offset);
+        }
+    });
+}
+
+inline void DODAMapChain::run(std::vector<uint32_t>& output) {
+    const std::vector<int> stages = std::move(stages_);
+    stages_.clear();
+    const std::vector<uint32_t>& input = *input_;
+
+    RuntimeMetadata metadata;
+    metadata.vector_size_check = (input.size() == output.size());
+    metadata.size_bytes = static_cast<int>(input.size() * sizeof(uint32_t));
+    metadata.replicas = doda_map_replicas();    // Elementwise: spread over the clusters
+    if (!metadata.vector_size_check) {
+        std::cerr << "[ERROR] Input vector size (" << input.size()
+                << ") is not equal to output vector size (" << output.size()
+                << ").\n";
+        assert(metadata.vector_size_check && "Input and output vector sizes must match.");
+    }
+
+    DODAKernelRegistry& registry = doda_kernel_registry();
+    std::vector<DODAKernelRegistry::Kernel> kernels;
+    for (int lambda_index : stages) {
+        kernels.push_back(registry.lookup(lambda_index));
+        assert(kernels.back().fn && "Failed to find lambda symbol in liblambda.so");
+    }
+
+    // Produce the fused bitstream; when the compiler cannot fuse, produce one bitstream per stage
+    // and the simulator runs the stages one after another
+    if (stages.size() == 1 || !registry.getFused(stages, metadata)) {
+        for (int lambda_index : stages) {
+            registry.get(lambda_index, metadata);
+        }
+    }
+
+    run_lambda_chain_on_cpu(kernels, input.data(), output.data(), std::min(input.size(), output.size()));
 }
 #endif
 
 #ifdef DODA_SIMULATION_MODE
-// Function to execute on DODA hardware simulator
-inline void execute_on_doda_simulator(int lambda_index, const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
-    // Create simulator instance
+// A simulator instance together with the (loop-bound patched) program it currently holds
+struct ProgrammedSimulator {
     DODASimulator simulator;
-    
-    // Initialize the simulator
-    simulator.initialize();
-    
-    // Read the bitstream file generated by load_lambda
-    std::string bitstream_path = "./obj/lambda_" + std::to_string(lambda_index) + "_bitstream.txt";
-    std::ifstream bitstream_file(bitstream_path);
-    
-    if (!bitstream_file.is_open()) {
-        std::cerr << "[ERROR] Failed to open bitstream file: " << bitstream_path << std::endl;
-        return;
+    PackedBitstream program;        // Owned copy of the bitstream; the loop bound is patched per tile
+    size_t programmed_bound = 0;    // Loop bound currently programmed into the fabric (0 = not programmed)
+    uint64_t key = 0;               // Content hash of the original bitstream
+    size_t replicas = 1;            // Copies of the kernel loop, one per cluster (see doda_mapper::replica_count)
+    // Later configurations of a temporally partitioned kernel (see doda_mapper::construct_phases),
+    // run after program on the same SPM contents, and the tile length they were compiled for
+    std::vector<PackedBitstream> phases;
+    size_t tile_len = 0;
+
+    explicit ProgrammedSimulator(const PackedBitstream& bitstream,
+                                 const std::vector<std::shared_ptr<const PackedBitstream>>& later_phases = {})
+        : program(bitstream.clone()), key(bitstream.contentHash()),
+          replicas(static_cast<size_t>(std::max(1, bitstream.numLoops()))) {
+        for (const auto& phase : later_phases) {
+            phases.push_back(phase->clone());
+        }
+        if (!phases.empty()) {
+            tile_len = static_cast<size_t>(std::max<int64_t>(1, bitstream.loopBound()));
+        }
+        simulator.initialize();
     }
-    
-    // Parse the bitstream file to get instructions
-    std::vector<std::vector<std::string>> instructions;
-    std::string line;
-    std::vector<std::string> current_cluster;
-    
-    while (std::getline(bitstream_file, line)) {
-        if (line.empty()) {
-            if (!current_cluster.empty()) {
-                instructions.push_back(current_cluster);
-                current_cluster.clear();
+};
+
+// Process-wide cache of programmed simulator instances, keyed by bitstream content hash.
+// A repeated call with the same bitstream skips construction, reset and programming and only
+// loads new data, runs and reads back. Least-recently-used instances are evicted beyond capacity.
+// Instances are handed out as shared_ptr, so evicting one that is still in use is safe; a single
+// instance must not be driven from two threads at once.
+class DODASimulatorCache {
+public:
+    explicit DODASimulatorCache(size_t capacity = 4) : capacity_(capacity) {}
+
+    // later_phases: the other configurations of a temporally partitioned kernel; its first
+    // bitstream identifies the kernel
+    std::shared_ptr<ProgrammedSimulator> acquire(const PackedBitstream& bitstream,
+                                                 const std::vector<std::shared_ptr<const PackedBitstream>>& later_phases = {}) {
+        const uint64_t key = bitstream.contentHash();
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = entries_.find(key);
+        if (it != entries_.end() && it->second.original.sameContent(bitstream)) {
+            it->second.last_use = ++tick_;
+            hits_++;
+            return it->second.instance;
+        }
+
+        misses_++;
+        Entry entry;
+        entry.original = bitstream.clone();
+        entry.instance = std::make_shared<ProgrammedSimulator>(bitstream, later_phases);
+        entry.last_use = ++tick_;
+        std::shared_ptr<ProgrammedSimulator> instance = entry.instance;
+        entries_[key] = std::move(entry);
+        evictOverCapacity();
+        return instance;
+    }
+
+    // Explicit eviction
+    bool evict(const PackedBitstream& bitstream) { return evict(bitstream.contentHash()); }
+    bool evict(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.erase(key) > 0;
+    }
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+
+    // Size limit (0 disables caching: every acquire builds a fresh instance)
+    void setCapacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        evictOverCapacity();
+    }
+    size_t capacity() const { std::lock_guard<std::mutex> lock(mutex_); return capacity_; }
+    size_t size() const { std::lock_guard<std::mutex> lock(mutex_); return entries_.size(); }
+    size_t hits() const { std::lock_guard<std::mutex> lock(mutex_); return hits_; }
+    size_t misses() const { std::lock_guard<std::mutex> lock(mutex_); return misses_; }
+
+private:
+    struct Entry {
+        PackedBitstream original;                       // For collision checks on hit
+        std::shared_ptr<ProgrammedSimulator> instance;
+        uint64_t last_use = 0;
+    };
+
+    void evictOverCapacity() {
+        while (entries_.size() > capacity_) {
+            auto lru = entries_.begin();
+            for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+                if (it->second.last_use < lru->second.last_use) lru = it;
             }
-        } else if (line.find("#") == 0) {
-            // Skip all comment lines (including cluster headers and cluster bitstream comments)
-            continue;
-        } else if (!line.empty()) {
-            // Add any non-empty, non-comment line as a binary instruction
-            #ifdef VERBOSE
-            std::cout << "Parsed instruction: length=" << line.length() << " content=" << line.substr(0, 20) << "..." << std::endl;
-            #endif
-            current_cluster.push_back(line);
+            entries_.erase(lru);
         }
     }
-    
-    // Add the last cluster if it exists
-    if (!current_cluster.empty()) {
-        instructions.push_back(current_cluster);
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    size_t capacity_;
+    uint64_t tick_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+// The process-wide simulator cache used by map_on_doda
+inline DODASimulatorCache& doda_simulator_cache() {
+    static DODASimulatorCache cache;
+    return cache;
+}
+
+// Element range [begin, begin + len) of a tile held by one cluster's SPM
+struct DODATileBank {
+    size_t begin;
+    size_t len;
+};
+
+// Banks of a tile: stream k of a multi-stream kernel is in cluster k (each bank holds the whole
+// tile), while replica r of a replicated kernel holds partition r of the single stream
+inline std::vector<DODATileBank> doda_tile_banks(size_t num_streams, size_t replicas, size_t tile_len) {
+    std::vector<DODATileBank> banks;
+    if (replicas <= 1) {
+        banks.assign(num_streams, DODATileBank{0, tile_len});
+        return banks;
     }
-    
-    bitstream_file.close();
-    
-    // Program the DODA hardware with the bitstream
-    simulator.programInstructions(instructions);
-    
-    // Prepare memory data from input vector
-    std::vector<std::vector<int>> memory_data;
-    std::vector<int> input_data;
-    for (uint32_t val : input) {
-        input_data.push_back(static_cast<int>(val));
-    }
-    memory_data.push_back(input_data);
-
-    #ifdef VERBOSE
-        std::cout << "memory_data:" << std::endl;
-        for (size_t i = 0; i < memory_data.size(); ++i) {
-            std::cout << "  Cluster " << i << ": [";
-            for (size_t j = 0; j < memory_data[i].size(); ++j) {
-                std::cout << memory_data[i][j];
-                if (j + 1 < memory_data[i].size()) std::cout << ", ";
+    const size_t part_len = (tile_len + replicas - 1) / replicas;
+    for (size_t r = 0; r < replicas; ++r) {
+        const size_t begin = std::min(r * part_len, tile_len);
+        banks.push_back(DODATileBank{begin, std::min(part_len, tile_len - begin)});
+    }
+    return banks;
+}
+
+// Runs a programmed kernel over arbitrary-length streams by tiling them into SPM-sized chunks.
+// Input stream k is loaded into the SPM of cluster k; a replicated kernel instead splits each
+// tile of its single input across the replicas' clusters, so a tile holds replicas SPMs worth
+// of elements. After each tile has run, read_tile(offset, tile_len) reads its results back.
+// The loop-bound constant (continue_condition / terminal_condition) is patched per tile; the
+// fabric is only reprogrammed when that constant changes, so full tiles repeat just load, run
+// and readback. A temporally partitioned kernel uses the tile length it was compiled for and runs
+// every phase on each tile: before each later phase the SPMs are read back, the fabric is reset
+// and programmed with the phase, and the SPM image is loaded again, so the values spilled by the
+// previous phase survive the reset.
+template<typename ReadTile>
+inline void for_each_doda_tile(ProgrammedSimulator& instance, const std::vector<const std::vector<uint32_t>*>& inputs,
+                               ReadTile read_tile) {
+    General_Params g;
+    const size_t replicas = inputs.size() == 1 ? instance.replicas : 1;
+    const bool phased = !instance.phases.empty();
+    const size_t tile_size = phased ? instance.tile_len : static_cast<size_t>(g.num_data_mem_entries) * replicas;
+    DODASimulator& simulator = instance.simulator;
+    const size_t length = inputs.empty() ? 0 : inputs[0]->size();
+
+    for (size_t offset = 0; offset < length; offset += tile_size) {
+        const size_t tile_len = std::min(tile_size, length - offset);
+        const std::vector<DODATileBank> banks = doda_tile_banks(inputs.size(), replicas, tile_len);
+        const size_t loop_bound = banks[0].len;     // Every loop runs as long as the longest bank
+
+        if (loop_bound != instance.programmed_bound || phased) {
+            if (loop_bound != instance.programmed_bound) {
+                if (instance.program.setLoopBound(static_cast<uint32_t>(loop_bound)) == 0 && length > tile_size) {
+                    std::cerr << "[ERROR] Bitstream has no loop-bound PEs; cannot tile an input of "
+                              << length << " elements." << std::endl;
+                    return;
+                }
+                for (PackedBitstream& phase : instance.phases) {
+                    phase.setLoopBound(static_cast<uint32_t>(loop_bound));
+                }
+            }
+            if (instance.programmed_bound != 0) {
+                simulator.reset();
+            }
+            // Program the DODA hardware with the bitstream
+            simulator.programInstructions(instance.program);
+            instance.programmed_bound = loop_bound;
+        }
+        // Prepare memory data from this tile: one cluster per input stream or per replica
+        std::vector<std::vector<int>> memory_data(banks.size());
+        for (size_t b = 0; b < banks.size(); ++b) {
+            const std::vector<uint32_t>& input = *inputs[replicas > 1 ? 0 : b];
+            memory_data[b].reserve(banks[b].len);
+            for (size_t i = 0; i < banks[b].len; ++i) {
+                memory_data[b].push_back(static_cast<int>(input[offset + banks[b].begin + i]));
             }
-            std::cout << "]" << std::endl;
         }
-    #endif
 
-    
-    // Load memory data into DODA
-    simulator.loadMemoryData(memory_data);
-    
-    // Start execution
-    simulator.startExecution();
-    
-    // Wait for completion
-    simulator.waitForCompletion();
-    
-    // Read results from memory
-    auto result_memory = simulator.readMemory();
-    
-    // Extract output data
-    if (!result_memory.empty() && result_memory[0].size() >= output.size()) {
-        for (size_t i = 0; i < output.size(); ++i) {
-            output[i] = static_cast<uint32_t>(result_memory[0][i]);
+        #ifdef VERBOSE
+        std::cout << "Tile [" << offset << ", " << offset + tile_len << ") of " << length << std::endl;
+        #endif
+
+        // Load memory data into DODA (only the tile's words, no zero padding)
+        simulator.loadMemoryData(memory_data, false);
+        
+        // Start execution
+        simulator.startExecution();
+        
+        // Wait for completion
+        simulator.waitForCompletion();
+
+        // Later phases work on what the previous phase left in the SPM. The fabric is reset before
+        // each one is programmed, so the SPM image is read back first and loaded again afterwards.
+        if (phased) {
+            const std::vector<SpmRange> spm(instance.program.numClusters(), SpmRange(0, g.num_data_mem_entries));
+            for (const PackedBitstream& phase : instance.phases) {
+                const std::vector<std::vector<uint32_t>> image = simulator.readMemory(spm);
+                simulator.reset();
+                simulator.programInstructions(phase);
+                std::vector<std::vector<int>> memory_image(image.size());
+                for (size_t c = 0; c < image.size(); ++c) {
+                    memory_image[c].assign(image[c].begin(), image[c].end());
+                }
+                simulator.loadMemoryData(memory_image, false);
+                simulator.startExecution();
+                simulator.waitForCompletion();
+            }
+        }
+
+        read_tile(offset, tile_len);
+    }
+}
+
+// Map kernel: output stream m is read back from the SPM of cluster m, or for a replicated
+// kernel partition r of the single output from the SPM of cluster r
+inline void run_tiled_on_doda_simulator(ProgrammedSimulator& instance,
+                                        const std::vector<const std::vector<uint32_t>*>& inputs,
+                                        const std::vector<std::vector<uint32_t>*>& outputs) {
+    DODASimulator& simulator = instance.simulator;
+    const size_t replicas = inputs.size() == 1 && outputs.size() == 1 ? instance.replicas : 1;
+    for_each_doda_tile(instance, inputs, [&](size_t offset, size_t tile_len) {
+        const std::vector<DODATileBank> banks = doda_tile_banks(outputs.size(), replicas, tile_len);
+
+        // Read back only the tile's output words, from the cluster of each bank
+        std::vector<SpmRange> ranges;
+        for (const DODATileBank& bank : banks) {
+            ranges.push_back(SpmRange(0, static_cast<int>(bank.len)));
+        }
+        auto result_memory = simulator.readMemory(ranges);
+        
+        // Extract output data
+        for (size_t b = 0; b < banks.size(); ++b) {
+            std::vector<uint32_t>& output = *outputs[replicas > 1 ? 0 : b];
+            const size_t begin = offset + banks[b].begin;
+            if (result_memory[b].size() < banks[b].len) {
+                std::cerr << "[ERROR] Readback returned " << result_memory[b].size() << " of "
+                          << banks[b].len << " words from cluster " << b << " for tile at " << offset << std::endl;
+            }
+            for (size_t i = 0; i < result_memory[b].size() && begin + i < output.size(); ++i) {
+                output[begin + i] = result_memory[b][i];
+            }
+        }
+    });
+}
+
+// Opcode PackedBitstream::reductionOpcode reports for a kernel compiled for op, or -1
+inline int reduce_accumulator_opcode(DODAReduceOp op) {
+    typedef InstructionLayout L;
+    switch (op) {
+        case DODAReduceOp::SUM: return L::OPCODE_ADD;
+        case DODAReduceOp::MIN: return L::OPCODE_CLT;
+        case DODAReduceOp::MAX: return L::OPCODE_CGT;
+        case DODAReduceOp::AND: return L::OPCODE_AND;
+        case DODAReduceOp::OR: return L::OPCODE_OR;
+        case DODAReduceOp::XOR: return L::OPCODE_XOR;
+        default: return -1;
+    }
+}
+
+// Reduction kernel: each tile stores its partial result at address 0 of cluster 0, so a tile
+// reads back one word instead of the whole tile. Partial results are folded into init. Throws
+// if the bitstream is not a reduction kernel for op (e.g. it was built for map_on_doda).
+inline uint32_t reduce_tiled_on_doda_simulator(ProgrammedSimulator& instance, DODAReduceOp op, uint32_t init,
+                                               const std::vector<const std::vector<uint32_t>*>& inputs) {
+    const PackedBitstream& last_phase = instance.phases.empty() ? instance.program : instance.phases.back();
+    const int expected = reduce_accumulator_opcode(op);
+    if (expected < 0 || last_phase.reductionOpcode() != expected) {
+        throw std::runtime_error(std::string("Bitstream is not a '") + reduce_op_name(op) +
+                                 "' reduction kernel; rebuild it with reduce_on_doda in CPU mode");
+    }
+
+    DODASimulator& simulator = instance.simulator;
+    uint32_t result = init;
+    for_each_doda_tile(instance, inputs, [&](size_t offset, size_t /*tile_len*/) {
+        auto result_memory = simulator.readMemory(std::vector<SpmRange>(1, SpmRange(0, 1)));
+        if (result_memory[0].empty()) {
+            std::cerr << "[ERROR] Readback returned no partial result for tile at " << offset << std::endl;
+            return;
+        }
+        result = reduce_combine(op, result, result_memory[0][0]);
+    });
+    return result;
+}
+
+// Single input and output stream (cluster 0)
+inline void run_tiled_on_doda_simulator(ProgrammedSimulator& instance,
+                                        const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
+    run_tiled_on_doda_simulator(instance, std::vector<const std::vector<uint32_t>*>(1, &input),
+                                std::vector<std::vector<uint32_t>*>(1, &output));
+}
+
+// Process-wide table of the lambdas' bitstreams, each loaded (memory-mapped) once on first use
+class DODAKernelRegistry {
+public:
+    struct Kernel {
+        std::shared_ptr<const PackedBitstream> bitstream;   // nullptr if it could not be loaded
+        std::vector<std::shared_ptr<const PackedBitstream>> phases;    // Phases after the first, if partitioned
+    };
+
+    Kernel get(int lambda_index) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (lambda_index < 0) return Kernel();
+        if (static_cast<size_t>(lambda_index) >= kernels_.size()) {
+            kernels_.resize(lambda_index + 1);
+        }
+        Kernel& kernel = kernels_[lambda_index];
+        if (!kernel.bitstream) {
+            kernel.bitstream = load(lambda_index);
+            kernel.phases = loadPhases(lambda_kernel_name(lambda_index));
+        }
+        return kernel;
+    }
+
+    // A kernel other than a single lambda (e.g. a fused map chain); no bitstream if it was never compiled
+    Kernel getNamed(const std::string& kernel_name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = named_.find(kernel_name);
+        if (it != named_.end()) {
+            return it->second;
+        }
+        Kernel kernel;
+        if (access(kernel_bitstream_bin_path(kernel_name).c_str(), F_OK) == 0 ||
+            access(kernel_bitstream_text_path(kernel_name).c_str(), F_OK) == 0) {
+            kernel.bitstream = load(kernel_name);
+            kernel.phases = loadPhases(kernel_name);
+            named_[kernel_name] = kernel;
+        }
+        return kernel;
+    }
+
+    // Drops a loaded bitstream, e.g. after it was regenerated on disk
+    void invalidate(int lambda_index) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (lambda_index >= 0 && static_cast<size_t>(lambda_index) < kernels_.size()) {
+            kernels_[lambda_index] = Kernel();
+        }
+    }
+
+private:
+    // Map the packed bitstream generated by load_lambda, falling back to the text export
+    static std::shared_ptr<const PackedBitstream> load(int lambda_index) {
+        return load(lambda_kernel_name(lambda_index));
+    }
+
+    static std::shared_ptr<const PackedBitstream> load(const std::string& kernel_name, int phase = 0) {
+        std::string bitstream_path = kernel_phase_bitstream_bin_path(kernel_name, phase);
+        if (access(bitstream_path.c_str(), F_OK) != 0) {
+            bitstream_path = kernel_phase_bitstream_text_path(kernel_name, phase);
         }
+        try {
+            auto bitstream = std::make_shared<PackedBitstream>(PackedBitstream::load(bitstream_path));
+            #ifdef VERBOSE
+            std::cout << "Loaded bitstream " << bitstream_path << ": " << bitstream->numClusters() << " clusters x "
+                      << bitstream->numPePerCluster() << " PEs" << (bitstream->isMapped() ? " (mapped)" : "") << std::endl;
+            #endif
+            return bitstream;
+        } catch (const std::exception& e) {
+            std::cerr << "[ERROR] Failed to load bitstream file: " << bitstream_path << " (" << e.what() << ")" << std::endl;
+            return nullptr;
+        }
+    }
+
+    // Phases 1, 2, ... of a temporally partitioned kernel, up to the first missing file
+    static std::vector<std::shared_ptr<const PackedBitstream>> loadPhases(const std::string& kernel_name) {
+        std::vector<std::shared_ptr<const PackedBitstream>> phases;
+        for (int p = 1; access(kernel_phase_bitstream_bin_path(kernel_name, p).c_str(), F_OK) == 0 ||
+                        access(kernel_phase_bitstream_text_path(kernel_name, p).c_str(), F_OK) == 0; p++) {
+            std::shared_ptr<const PackedBitstream> phase = load(kernel_name, p);
+            if (!phase) break;
+            phases.push_back(phase);
+        }
+        return phases;
+    }
+
+    std::mutex mutex_;
+    std::vector<Kernel> kernels_;   // Indexed by lambda index
+    std::map<std::string, Kernel> named_;
+};
+
+// The kernel registry used by map_on_doda
+inline DODAKernelRegistry& doda_kernel_registry() {
+    static DODAKernelRegistry registry;
+    return registry;
+}
+
+// Function to execute on DODA hardware simulator
+inline void execute_on_doda_simulator(int lambda_index, const std::vector<const std::vector<uint32_t>*>& inputs,
+                                      const std::vector<std::vector<uint32_t>*>& outputs) {
+    DODAKernelRegistry::Kernel kernel = doda_kernel_registry().get(lambda_index);
+    if (!kernel.bitstream) {
+        return;
+    }
+
+    // Reuse a programmed simulator instance for this bitstream if one is cached
+    std::shared_ptr<ProgrammedSimulator> instance = doda_simulator_cache().acquire(*kernel.bitstream, kernel.phases);
+    
+    run_tiled_on_doda_simulator(*instance, inputs, outputs);
+}
+
+inline void execute_on_doda_simulator(int lambda_index, const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
+    execute_on_doda_simulator(lambda_index, std::vector<const std::vector<uint32_t>*>(1, &input),
+                              std::vector<std::vector<uint32_t>*>(1, &output));
+}
+
+inline void DODAMapChain::run(std::vector<uint32_t>& output) {
+    const std::vector<int> stages = std::move(stages_);
+    stages_.clear();
+    const std::vector<uint32_t>& input = *input_;
+
+    if (input.size() != output.size()) {
+        std::cerr << "[ERROR] Input vector size (" << input.size() 
+                << ") is not equal to output vector size (" << output.size() 
+                << ").\n";
+        assert(false && "Input and output vector sizes must match.");
+    }
+    if (stages.empty()) {
+        std::copy(input.begin(), input.end(), output.begin());
+        return;
+    }
+    if (stages.size() == 1) {
+        execute_on_doda_simulator(stages[0], input, output);
+        return;
+    }
+
+    // One kernel for the whole chain: intermediate values never leave the fabric
+    DODAKernelRegistry::Kernel fused = doda_kernel_registry().getNamed(DODAMapChain::kernelName(stages));
+    if (fused.bitstream) {
+        std::shared_ptr<ProgrammedSimulator> instance = doda_simulator_cache().acquire(*fused.bitstream, fused.phases);
+        run_tiled_on_doda_simulator(*instance, input, output);
+        return;
+    }
+
+    // No fused bitstream (the compiler could not fuse): run the stages one by one through the SPM
+    std::cerr << "[WARNING] No bitstream for " << DODAMapChain::kernelName(stages) << "; running its "
+              << stages.size() << " stages one by one" << std::endl;
+    execute_on_doda_simulator(stages[0], input, output);
+    for (size_t k = 1; k < stages.size(); ++k) {
+        execute_on_doda_simulator(stages[k], output, output);
     }
 }
+
+// Function to execute a reduction on DODA hardware simulator
+inline uint32_t reduce_on_doda_simulator(int lambda_index, DODAReduceOp op, uint32_t init,
+                                         const std::vector<uint32_t>& input) {
+    DODAKernelRegistry::Kernel kernel = doda_kernel_registry().get(lambda_index);
+    if (!kernel.bitstream) {
+        return init;
+    }
+
+    std::shared_ptr<ProgrammedSimulator> instance = doda_simulator_cache().acquire(*kernel.bitstream, kernel.phases);
+    return reduce_tiled_on_doda_simulator(*instance, op, init, std::vector<const std::vector<uint32_t>*>(1, &input));
+}
 #endif
 
-// Only allow functions that take uint32_t and return uint32_t
-static int g_lambda_counter = 0;        // global counter to keep track of lambda IDs
+// Multi-stream kernels take one uint32_t per input stream and return a uint32_t (one output
+// stream) or a std::array<uint32_t, M> (M output streams). Stream k lives in the SPM of
+// cluster k, so there are at most DODA_MAX_STREAMS of each.
+static const size_t DODA_MAX_STREAMS = 4;
+
+template<size_t M> struct doda_stream_result { typedef std::array<uint32_t, M> type; };
+template<> struct doda_stream_result<1> { typedef uint32_t type; };
+
+template<size_t K> using doda_stream_arg_t = uint32_t;
+
+// Signature of the extracted lambda of a kernel with one input per index in the sequence and M outputs
+template<size_t M, typename Indices> struct doda_stream_fn;
+template<size_t M, size_t... K> struct doda_stream_fn<M, std::index_sequence<K...>> {
+    typedef typename doda_stream_result<M>::type (*type)(doda_stream_arg_t<K>...);
+};
+
+// Result type of a kernel called with one uint32_t per input stream (declaration only)
+template<typename Func, size_t... K>
+auto doda_stream_call_result(std::index_sequence<K...>) -> decltype(std::declval<Func&>()(doda_stream_arg_t<K>()...));
+
+// f(inputs[0][i], inputs[1][i], ...)
+template<typename Func, size_t... K>
+inline auto doda_call_streams(Func& f, const std::vector<uint32_t>* const* inputs, size_t i, std::index_sequence<K...>)
+    -> decltype(f((*inputs[K])[i]...)) {
+    return f((*inputs[K])[i]...);
+}
+
+inline void doda_store_streams(uint32_t value, std::vector<uint32_t>* const* outputs, size_t i) {
+    (*outputs[0])[i] = value;
+}
+template<size_t M>
+inline void doda_store_streams(const std::array<uint32_t, M>& values, std::vector<uint32_t>* const* outputs, size_t i) {
+    for (size_t m = 0; m < M; ++m) {
+        (*outputs[m])[i] = values[m];
+    }
+}
+
+// True if every input and output stream has the length of the first input
+template<size_t N, size_t M>
+inline bool doda_stream_sizes_match(const std::vector<uint32_t>* const (&inputs)[N],
+                                    std::vector<uint32_t>* const (&outputs)[M]) {
+    const size_t length = inputs[0]->size();
+    bool match = true;
+    for (size_t k = 0; k < N; ++k) {
+        if (inputs[k]->size() != length) {
+            std::cerr << "[ERROR] Input stream " << k << " size (" << inputs[k]->size()
+                      << ") is not equal to input stream 0 size (" << length << ").\n";
+            match = false;
+        }
+    }
+    for (size_t m = 0; m < M; ++m) {
+        if (outputs[m]->size() != length) {
+            std::cerr << "[ERROR] Output stream " << m << " size (" << outputs[m]->size()
+                      << ") is not equal to input stream 0 size (" << length << ").\n";
+            match = false;
+        }
+    }
+    return match;
+}
 
+// Only allow functions that take uint32_t and return uint32_t.
+// The kernel is identified by its call site (see lambda_call_site_index); call_file and
+// call_line default to the caller's location and are not meant to be passed explicitly.
 #ifndef DODA_SIMULATION_MODE
 // CPU mode: generate bitstream and execute on CPU
 template<typename Func>
 typename std::enable_if<
     std::is_same<typename std::result_of<Func(uint32_t)>::type, uint32_t>::value
 >::type
-map_on_doda(Func /*f*/, const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
+map_on_doda(Func /*f*/, const std::vector<uint32_t>& input, std::vector<uint32_t>& output,
+            const char* call_file = __builtin_FILE(), int call_line = __builtin_LINE()) {
+    const int lambda_index = lambda_call_site_index<Func>(call_file, call_line);
+
     // Check if the input and output vectors are of the same size
     RuntimeMetadata metadata;
     metadata.vector_size_check = (input.size() == output.size());
     // Later, we might have to support the case where input and output have different types.
-    metadata.size_bytes = sizeof(input);
+    metadata.size_bytes = static_cast<int>(input.size() * sizeof(uint32_t));
+    metadata.replicas = doda_map_replicas();    // Elementwise: spread over the clusters
     
     // Size safety check
     if (!metadata.vector_size_check) {
@@ -303,12 +1471,88 @@ map_on_doda(Func /*f*/, const std::vector<uint32_t>& input, std::vector<uint32_t
         assert(metadata.vector_size_check && "Input and output vector sizes must match.");
     }
     
-    // Instantiate the metadata struct and pass it to load_lambda
-    lambda_t compiled_lambda = load_lambda(g_lambda_counter++, metadata);
-    
-    // Execute the lambda on each input element
-    for (size_t i = 0; i < input.size(); ++i)
-        output[i] = compiled_lambda(input[i]);
+    // Constant-time lookup; the bitstream is only (re)produced when the input size changes
+    DODAKernelRegistry::Kernel kernel = doda_kernel_registry().get(lambda_index, metadata);
+    assert(kernel.fn && "Failed to find lambda symbol in liblambda.so");
+
+    // Execute the lambda on the input elements
+    run_lambda_on_cpu(kernel.fn, kernel.batch, input.data(), output.data(),
+                      std::min(input.size(), output.size()));
+}
+
+// Multi-stream kernel, e.g. map_on_doda([](uint32_t a, uint32_t b) { return a + b; }, {&a, &b}, {&sum})
+template<typename Func, size_t N, size_t M>
+typename std::enable_if<
+    N <= DODA_MAX_STREAMS && M <= DODA_MAX_STREAMS &&
+    std::is_same<decltype(doda_stream_call_result<Func>(std::make_index_sequence<N>())),
+                 typename doda_stream_result<M>::type>::value
+>::type
+map_on_doda(Func /*f*/, const std::vector<uint32_t>* const (&inputs)[N], std::vector<uint32_t>* const (&outputs)[M],
+            const char* call_file = __builtin_FILE(), int call_line = __builtin_LINE()) {
+    const int lambda_index = lambda_call_site_index<Func>(call_file, call_line);
+    const size_t length = inputs[0]->size();
+
+    RuntimeMetadata metadata;
+    metadata.vector_size_check = doda_stream_sizes_match(inputs, outputs);
+    metadata.size_bytes = static_cast<int>(length * sizeof(uint32_t));
+    assert(metadata.vector_size_check && "Input and output stream sizes must match.");
+
+    // Produce the bitstream; the bitstream is only (re)produced when the stream length changes
+    DODAKernelRegistry::Kernel kernel = doda_kernel_registry().get(lambda_index, metadata);
+    assert(kernel.fn && "Failed to find lambda symbol in liblambda.so");
+    // Multi-stream DFGs are mapped by libdoda_compiler_api (doda_compile_dfg_buffer); the
+    // file-based doda_compile_dfg of libdoda_c_api only maps single-stream kernels
+    assert(kernel.compiledFor(metadata) && "DODA compilation failed");
+
+    // Run the extracted lambda. The batch entry point takes the streams back to back, so each
+    // task gathers a block of every input stream, maps it and scatters the output streams.
+    const std::vector<uint32_t>* const* in = inputs;
+    std::vector<uint32_t>* const* out = outputs;
+    const size_t block_size = 1024;
+    doda_thread_pool().parallelFor(length, 1 << 15, [&](size_t begin, size_t end) {
+        if (!kernel.batch) {
+            auto fn = reinterpret_cast<typename doda_stream_fn<M, std::make_index_sequence<N>>::type>(kernel.fn);
+            for (size_t i = begin; i < end; ++i) {
+                doda_store_streams(doda_call_streams(fn, in, i, std::make_index_sequence<N>()), out, i);
+            }
+            return;
+        }
+        uint32_t block_in[N * block_size];
+        uint32_t block_out[M * block_size];
+        for (size_t offset = begin; offset < end; offset += block_size) {
+            const size_t len = std::min(block_size, end - offset);
+            for (size_t k = 0; k < N; ++k) {
+                std::copy(in[k]->begin() + offset, in[k]->begin() + offset + len, block_in + k * len);
+            }
+            kernel.batch(block_in, block_out, len);
+            for (size_t m = 0; m < M; ++m) {
+                std::copy(block_out + m * len, block_out + (m + 1) * len, out[m]->begin() + offset);
+            }
+        }
+    });
+}
+
+// Reduction: returns init <op> f(input[0]) <op> f(input[1]) ..., e.g.
+// reduce_on_doda(DODAReduceOp::SUM, 0, [](uint32_t x) { return x * x; }, input)
+template<typename Func>
+typename std::enable_if<
+    std::is_same<typename std::result_of<Func(uint32_t)>::type, uint32_t>::value, uint32_t
+>::type
+reduce_on_doda(DODAReduceOp op, uint32_t init, Func /*f*/, const std::vector<uint32_t>& input,
+               const char* call_file = __builtin_FILE(), int call_line = __builtin_LINE()) {
+    const int lambda_index = lambda_call_site_index<Func>(call_file, call_line);
+
+    RuntimeMetadata metadata;
+    metadata.vector_size_check = true;
+    metadata.size_bytes = static_cast<int>(input.size() * sizeof(uint32_t));
+    metadata.reduce_op = op;
+
+    // The bitstream is only (re)produced when the input size or the op changes
+    DODAKernelRegistry::Kernel kernel = doda_kernel_registry().get(lambda_index, metadata);
+    assert(kernel.fn && "Failed to find lambda symbol in liblambda.so");
+    assert(kernel.compiledFor(metadata) && "DODA compilation failed");
+
+    return reduce_lambda_on_cpu(op, init, kernel.fn, kernel.batch, input.data(), input.size());
 }
 #else
 // Simulation mode: read bitstream and execute on simulator
@@ -316,7 +1560,10 @@ template<typename Func>
 typename std::enable_if<
     std::is_same<typename std::result_of<Func(uint32_t)>::type, uint32_t>::value
 >::type
-map_on_doda(Func /*f*/, const std::vector<uint32_t>& input, std::vector<uint32_t>& output) {
+map_on_doda(Func /*f*/, const std::vector<uint32_t>& input, std::vector<uint32_t>& output,
+            const char* call_file = __builtin_FILE(), int call_line = __builtin_LINE()) {
+    const int lambda_index = lambda_call_site_index<Func>(call_file, call_line);
+
     // Check if the input and output vectors are of the same size
     if (input.size() != output.size()) {
         std::cerr << "[ERROR] Input vector size (" << input.size() 
@@ -326,6 +1573,49 @@ map_on_doda(Func /*f*/, const std::vector<uint32_t>& input, std::vector<uint32_t
     }
     
     // Execute on simulator using existing bitstream
-    execute_on_doda_simulator(g_lambda_counter++, input, output);
+    execute_on_doda_simulator(lambda_index, input, output);
+}
+
+// Multi-stream kernel, e.g. map_on_doda([](uint32_t a, uint32_t b) { return a + b; }, {&a, &b}, {&sum})
+template<typename Func, size_t N, size_t M>
+typename std::enable_if<
+    N <= DODA_MAX_STREAMS && M <= DODA_MAX_STREAMS &&
+    std::is_same<decltype(doda_stream_call_result<Func>(std::make_index_sequence<N>())),
+                 typename doda_stream_result<M>::type>::value
+>::type
+map_on_doda(Func /*f*/, const std::vector<uint32_t>* const (&inputs)[N], std::vector<uint32_t>* const (&outputs)[M],
+            const char* call_file = __builtin_FILE(), int call_line = __builtin_LINE()) {
+    const int lambda_index = lambda_call_site_index<Func>(call_file, call_line);
+
+    if (!doda_stream_sizes_match(inputs, outputs)) {
+        assert(false && "Input and output stream sizes must match.");
+    }
+
+    // Execute on simulator using existing bitstream (stream k in cluster k)
+    execute_on_doda_simulator(lambda_index, std::vector<const std::vector<uint32_t>*>(inputs, inputs + N),
+                              std::vector<std::vector<uint32_t>*>(outputs, outputs + M));
+}
+
+// Reduction: returns init <op> f(input[0]) <op> f(input[1]) ...
+template<typename Func>
+typename std::enable_if<
+    std::is_same<typename std::result_of<Func(uint32_t)>::type, uint32_t>::value, uint32_t
+>::type
+reduce_on_doda(DODAReduceOp op, uint32_t init, Func /*f*/, const std::vector<uint32_t>& input,
+               const char* call_file = __builtin_FILE(), int call_line = __builtin_LINE()) {
+    const int lambda_index = lambda_call_site_index<Func>(call_file, call_line);
+
+    // Execute on simulator using existing bitstream
+    return reduce_on_doda_simulator(lambda_index, op, init, input);
+}
+#endif
+
+// Deferred mode: records the call site's kernel as the next stage of chain (see DODAMapChain)
+template<typename Func>
+typename std::enable_if<
+    std::is_same<typename std::result_of<Func(uint32_t)>::type, uint32_t>::value
+>::type
+map_on_doda(Func /*f*/, DODAMapChain& chain,
+            const char* call_file = __builtin_FILE(), int call_line = __builtin_LINE()) {
+    chain.record(lambda_call_site_index<Func>(call_file, call_line));
 }
-#endif
\ No newline at end of file
@@ -4,7 +4,11 @@
 #include <string>
 #include <memory>
 #include <cassert>
+#include <cstdint>
+#include <chrono>
+#include <ostream>
 #include "VDODA.h"
+#include "doda_bitstream.hpp"
 #include "verilated.h"
 
 // Helper function for hardware parameter calculations
@@ -51,6 +55,38 @@ public:
     // DON'T CHANGE THESE DEFAULT VALUES. THEY ARE MATCHED WITH THE RTL DESIGN.
 };
 
+// Cycle, eval() and wall-clock accounting for one simulator phase
+struct PhaseStats {
+    uint64_t calls = 0;
+    uint64_t cycles = 0;
+    uint64_t evals = 0;
+    uint64_t nanoseconds = 0;
+};
+
+// Per-phase accounting of a DODASimulator (see DODASimulator::getStats)
+struct SimulatorStats {
+    PhaseStats program;     // programInstructions
+    PhaseStats load;        // loadMemoryData
+    PhaseStats run;         // startExecution + waitForCompletion
+    PhaseStats readback;    // readMemory
+    uint64_t total_cycles = 0;
+    uint64_t total_evals = 0;
+    uint64_t load_stall_cycles[4] = {0, 0, 0, 0};  // Per cluster port: cycles a beat was offered but not accepted
+    uint64_t runs = 0;      // Completed load/run/readback sequences
+    uint64_t timeouts = 0;
+
+    void writeJson(std::ostream& os) const;
+};
+
+// Word address range [begin, end) in one cluster's scratchpad
+struct SpmRange {
+    int begin = 0;
+    int end = 0;
+    
+    SpmRange() = default;
+    SpmRange(int begin, int end) : begin(begin), end(end) {}
+};
+
 class DODASimulator {
 public:
     enum class Status {
@@ -61,6 +97,25 @@ public:
         DONE = 5
     };
 
+    // VCD tracing controls. A cycle is dumped only if it lies in [start_cycle, end_cycle), the
+    // current status is selected by phase_mask and, when a trigger is set, the trigger has fired.
+    struct TraceOptions {
+        std::string path = "doda_trace.vcd";
+        int levels = 99;                        // Hierarchy depth passed to VDODA::trace
+        uint64_t start_cycle = 0;
+        uint64_t end_cycle = UINT64_MAX;
+        unsigned phase_mask = ~0u;              // Bit per Status value, see phaseBit()
+        int trigger_from = -1;                  // Start dumping on a status transition from -> to
+        int trigger_to = -1;                    // (-1 = any); both -1 disables the trigger
+        uint64_t trigger_cycles = UINT64_MAX;   // Cycles to dump once triggered
+        // Ring-buffer mode (> 0): only the most recent cycles are kept on disk, rotating between
+        // <path>.prev and <path> every ring_cycles cycles, so a timeout leaves the last
+        // ring_cycles..2*ring_cycles cycles before it.
+        uint64_t ring_cycles = 0;
+        
+        static unsigned phaseBit(Status status) { return 1u << static_cast<unsigned>(status); }
+    };
+
     DODASimulator();
     ~DODASimulator();
 
@@ -68,10 +123,24 @@ public:
     void initialize();
     void reset();
     
-    // Clock management
+    // Clock management (one eval() per edge)
     void cycle();
     void posedge();
     void negedge();
+    void run(uint64_t cycles);                                          // Advance a batch of cycles
+    bool runUntilStatus(Status target_status, uint64_t max_cycles);     // Stop once status >= target
+    
+    // eval() accounting: calls made, and calls the previous posedge/eval/negedge driver would have added
+    uint64_t getEvalCount() const { return eval_count_; }
+    uint64_t getEvalsSaved() const { return evals_saved_; }
+    uint64_t getCycleCount() const { return cycle_count_; }
+    
+    // Per-phase statistics, cumulative since construction or resetStats()
+    SimulatorStats getStats() const;
+    void resetStats();
+    // Append one JSON line with the phase statistics of each run (load..readback) to this file;
+    // an empty path disables it. Defaults to $DODA_SIM_STATS_JSON when set.
+    void setStatsJsonPath(const std::string& path) { stats_json_path_ = path; }
     
     // Status monitoring
     Status getStatus() const;
@@ -80,20 +149,98 @@ public:
     
     // High-level programming interface
     void programInstructions(const std::vector<std::vector<std::string>>& binary_instructions);
-    void loadMemoryData(const std::vector<std::vector<int>>& memory_data);
+    void programInstructions(const PackedBitstream& bitstream);
+    // Packed words, laid out as in PackedBitstream: [cluster][pe][4 x uint32_t]
+    void programInstructions(const uint32_t* packed_words, int num_clusters, int num_pe_per_cluster);
+    // Streams memory_data[c] into cluster c's scratchpad from address 0. Every port has its own
+    // queue that advances on its own valid/ready handshake; loading completes once all queues have
+    // drained (stall cycles are counted per port in getStats()). With pad_to_capacity the
+    // remainder of every SPM is zero-filled (num_data_mem_entries words per cluster); without it,
+    // only the given words cross the AXI ports and clusters with no data see no traffic.
+    void loadMemoryData(const std::vector<std::vector<int>>& memory_data, bool pad_to_capacity = true);
     
     // Execution control
     void startExecution();
     void waitForCompletion(int max_cycles = 1000);
     
     // Memory operations
-    std::vector<std::vector<int>> readMemory();
+    std::vector<std::vector<int>> readMemory();          // All entries of all clusters, -1 where not valid
+    // Size-aware readback: drains only clusters with a non-empty range, only up to the range end,
+    // and returns the valid words at [begin, end) per cluster (no sentinel values). Gives up after
+    // max_idle_cycles cycles without a valid beat.
+    std::vector<std::vector<uint32_t>> readMemory(const std::vector<SpmRange>& ranges, int max_idle_cycles = 64);
+    
+    // Post-programming snapshot sweep: program this instance first, then each memory image is
+    // loaded, run and read back in its own child forked from the programmed state (copy-on-write,
+    // no reset/init/programming), with at most max_workers children alive at once. Results come
+    // back through shared memory, in the same order and layout as readMemory(). An image whose
+    // worker crashed, could not be forked, or did not finish within max_cycles yields an empty
+    // result (and is logged). max_workers == 0 uses one worker per online CPU.
+    std::vector<std::vector<std::vector<int>>> snapshotAndFork(
+        const std::vector<std::vector<std::vector<int>>>& memory_images,
+        int max_workers = 0, int max_cycles = 1000);
+    
+    // VCD tracing (off by default; costs one branch per edge while disabled)
+    void enableTrace(const TraceOptions& options);
+    void disableTrace();
+    void flushTrace();
+    bool isTracing() const { return static_cast<bool>(tfp_); }
     
     // Raw hardware access (for advanced users)
     VDODA* getHardware() { return doda_.get(); }
+    VerilatedContext* getContext() { return context_.get(); }
 
 private:
+    static constexpr int NUM_PORTS = 4;     // Clusters with their own programming/AXI ports
+
+    // Pointers to one cluster's ports on the Verilated model
+    struct ClusterPorts {
+        CData* inst_valid;
+        EData* inst_bits;           // 4 words, LSW first
+        CData* prog_read_done;
+        CData* spm_in_ready;
+        CData* spm_in_valid;
+        IData* spm_in_bits;
+        CData* spm_out_ready;
+        CData* spm_out_valid;
+        IData* spm_out_bits;
+        CData* spm_read_done;
+    };
+
+    // Each instance owns its Verilator context, so independent simulators can run on separate threads
+    std::unique_ptr<VerilatedContext> context_;
     std::unique_ptr<VDODA> doda_;
+    ClusterPorts ports_[NUM_PORTS];
+    uint64_t eval_count_ = 0;
+    uint64_t evals_saved_ = 0;
+    uint64_t cycle_count_ = 0;
+    
+    // Phase accounting
+    SimulatorStats stats_;
+    SimulatorStats run_stats_;      // Since the last per-run JSON dump
+    uint64_t stats_base_cycles_ = 0;
+    uint64_t stats_base_evals_ = 0;
+    std::string stats_json_path_;
+    // The run phase spans startExecution and waitForCompletion and is accounted once, when it ends
+    bool run_started_ = false;
+    uint64_t run_start_cycles_ = 0;
+    uint64_t run_start_evals_ = 0;
+    std::chrono::steady_clock::time_point run_start_time_;
+    class PhaseScope;
+    void dumpRunStats();
+    
+    // Tracing state
+    std::unique_ptr<VerilatedVcdC> tfp_;
+    TraceOptions trace_options_;
+    Status trace_last_status_ = Status::IDLE;
+    bool trace_triggered_ = false;
+    uint64_t trace_trigger_cycle_ = 0;
+    uint64_t trace_segment_start_ = 0;
+    void traceEdge(bool rising);
+    std::vector<std::vector<int>> drainMemory();
+    
+    void bindPorts();
+    void eval();
     
     // Helper methods for signal management
     void setSignal(bool& signal, bool value);
@@ -101,9 +248,10 @@ private:
     void pulseSignal(CData& signal);
     void clearProgrammingSignals();
     void clearMemorySignals();
+    void pulseClusterSignal(CData* ClusterPorts::*signal);
     
     // Internal state management
-    void waitForStatus(Status target_status);
+    bool waitForStatus(Status target_status, uint64_t max_cycles);    // false on timeout
     void sendInitSignal();
     void signalProgrammingDone();
     void signalMemoryLoadDone();
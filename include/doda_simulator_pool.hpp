@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <atomic>
+#include "doda_simulator.hpp"
+#include "doda_bitstream.hpp"
+
+// A (bitstream, memory image) simulation job
+struct SimulationJob {
+    std::shared_ptr<const PackedBitstream> bitstream;
+    std::vector<std::vector<int>> memory_image;     // [cluster][index], as for loadMemoryData
+    int max_cycles = 1000;
+};
+
+// Pool of independent DODASimulator instances, one per worker thread.
+//
+// Jobs are distributed round-robin over per-worker deques; an idle worker pops from
+// the front of its own deque and steals from the back of the others. Each worker keeps
+// its simulator programmed between jobs and only resets and reprograms it when the
+// next job carries a different bitstream, so sweeps over one kernel program each
+// worker once.
+class DODASimulatorPool {
+public:
+    using Result = std::vector<std::vector<int>>;   // readMemory() output
+
+    // num_workers == 0 uses std::thread::hardware_concurrency()
+    explicit DODASimulatorPool(unsigned num_workers = 0);
+    ~DODASimulatorPool();
+
+    DODASimulatorPool(const DODASimulatorPool&) = delete;
+    DODASimulatorPool& operator=(const DODASimulatorPool&) = delete;
+
+    // Job submission
+    std::future<Result> submit(SimulationJob job);
+    std::future<Result> submit(std::shared_ptr<const PackedBitstream> bitstream,
+                               std::vector<std::vector<int>> memory_image, int max_cycles = 1000);
+
+    // Block until every submitted job has finished
+    void waitIdle();
+
+    unsigned numWorkers() const { return static_cast<unsigned>(workers_.size()); }
+    size_t jobsCompleted() const { return jobs_completed_.load(); }
+    size_t jobsStolen() const { return jobs_stolen_.load(); }
+
+private:
+    struct Task {
+        SimulationJob job;
+        std::promise<Result> promise;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::unique_ptr<Task>> tasks;
+    };
+
+    // Per-worker simulator state
+    struct WorkerState {
+        std::unique_ptr<DODASimulator> simulator;
+        std::shared_ptr<const PackedBitstream> programmed;
+    };
+
+    void workerLoop(unsigned worker_idx);
+    std::unique_ptr<Task> popLocal(unsigned worker_idx);
+    std::unique_ptr<Task> steal(unsigned thief_idx);
+    static Result runJob(WorkerState& state, const SimulationJob& job);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::condition_variable idle_cv_;
+    size_t pending_ = 0;            // Submitted but not yet finished (guarded by wake_mutex_)
+    size_t queued_ = 0;             // Submitted but not yet picked up (guarded by wake_mutex_)
+    bool stopping_ = false;         // Guarded by wake_mutex_
+
+    std::atomic<unsigned> next_queue_{0};
+    std::atomic<size_t> jobs_completed_{0};
+    std::atomic<size_t> jobs_stolen_{0};
+};
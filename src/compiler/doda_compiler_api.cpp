@@ -0,0 +1,158 @@
+// In-memory entry points of the DODA compiler C API (doda_compiler_api.h), built on the header-only
+// doda_mapper into lib/libdoda_compiler_api.so (make build_compiler_api). The file-based calls and the
+// compiler context stay in libdoda_c_api.so; these entry points do not use the context handle, and
+// since doda_mapper keeps no process-global state they may run on several threads at once.
+//
+// Built with -fvisibility=hidden so that only the C entry points are exported and the mapper
+// definitions compiled in here never interpose on those of the other compiler libraries.
+
+#include <doda_compiler_api.h>
+#include <doda/doda_mapper.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define DODA_API_EXPORT __attribute__((visibility("default")))
+
+namespace {
+
+// Words of one packed configuration; the same for every DFG
+constexpr size_t PACKED_WORDS = static_cast<size_t>(doda_mapper_utils::BitstreamConstants::NUM_CLUSTER) *
+                                doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER *
+                                doda_mapper::WORDS_PER_INSTRUCTION;
+
+void fill_packed_info(doda_packed_info_t* info) {
+    if (info) {
+        info->num_clusters = doda_mapper_utils::BitstreamConstants::NUM_CLUSTER;
+        info->num_pe_per_cluster = doda_mapper_utils::BitstreamConstants::PES_PER_CLUSTER;
+        info->words_per_instruction = doda_mapper::WORDS_PER_INSTRUCTION;
+        info->num_words = PACKED_WORDS;
+    }
+}
+
+int metadata_input_size_bytes(const doda_runtime_metadata_t* metadata) {
+    return metadata ? metadata->input_size_bytes : -1;
+}
+
+} // namespace
+
+extern "C" {
+
+DODA_API_EXPORT doda_result_t doda_compile_dfg_buffer(
+    doda_compiler_handle_t /*handle*/,
+    const char* dfg_json,
+    size_t dfg_json_len,
+    const doda_runtime_metadata_t* metadata,
+    uint32_t* words,
+    size_t capacity_words,
+    doda_packed_info_t* info) {
+    if (dfg_json == nullptr) {
+        return DODA_ERROR_INVALID_INPUT;
+    }
+
+    // The size does not depend on the DFG, so a size query does not map it
+    fill_packed_info(info);
+    if (words == nullptr || capacity_words < PACKED_WORDS) {
+        return DODA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    try {
+        doda_mapper mapper(nlohmann::json::parse(dfg_json, dfg_json + dfg_json_len),
+                           metadata_input_size_bytes(metadata));
+        if (mapper.num_phases() != 1) {
+            std::cerr << "[doda_compile_dfg_buffer] DFG needs " << mapper.num_phases()
+                      << " configurations; compile it with doda_compile_dfg_phases" << std::endl;
+            return DODA_ERROR_COMPILATION_FAILED;
+        }
+        doda_mapper::generate_packed_bitstream(mapper.get_dfg(), words, capacity_words);
+    } catch (const nlohmann::json::exception& e) {
+        std::cerr << "[doda_compile_dfg_buffer] Invalid DFG JSON: " << e.what() << std::endl;
+        return DODA_ERROR_INVALID_INPUT;
+    } catch (const std::exception& e) {
+        std::cerr << "[doda_compile_dfg_buffer] " << e.what() << std::endl;
+        return DODA_ERROR_COMPILATION_FAILED;
+    }
+    return DODA_SUCCESS;
+}
+
+DODA_API_EXPORT doda_result_t doda_compile_dfg_phases(
+    doda_compiler_handle_t /*handle*/,
+    const char* dfg_json,
+    size_t dfg_json_len,
+    const doda_runtime_metadata_t* metadata,
+    uint32_t* words,
+    size_t capacity_words,
+    doda_packed_info_t* info,
+    size_t* num_phases) {
+    if (dfg_json == nullptr) {
+        return DODA_ERROR_INVALID_INPUT;
+    }
+
+    // The phase count is only known once the DFG is mapped, so a size query maps it too
+    try {
+        doda_mapper mapper(nlohmann::json::parse(dfg_json, dfg_json + dfg_json_len),
+                           metadata_input_size_bytes(metadata));
+        fill_packed_info(info);
+        if (num_phases) {
+            *num_phases = mapper.num_phases();
+        }
+        if (words == nullptr || capacity_words < PACKED_WORDS * mapper.num_phases()) {
+            return DODA_ERROR_BUFFER_TOO_SMALL;
+        }
+        for (size_t p = 0; p < mapper.num_phases(); p++) {
+            doda_mapper::generate_packed_bitstream(mapper.get_phase_dfg(p), words + p * PACKED_WORDS, PACKED_WORDS);
+        }
+    } catch (const nlohmann::json::exception& e) {
+        std::cerr << "[doda_compile_dfg_phases] Invalid DFG JSON: " << e.what() << std::endl;
+        return DODA_ERROR_INVALID_INPUT;
+    } catch (const std::exception& e) {
+        std::cerr << "[doda_compile_dfg_phases] " << e.what() << std::endl;
+        return DODA_ERROR_COMPILATION_FAILED;
+    }
+    return DODA_SUCCESS;
+}
+
+DODA_API_EXPORT doda_result_t doda_fuse_dfgs(
+    doda_compiler_handle_t /*handle*/,
+    const char* const* dfg_jsons,
+    const size_t* dfg_json_lens,
+    size_t num_stages,
+    char* fused_json,
+    size_t capacity,
+    size_t* fused_len) {
+    if (dfg_jsons == nullptr || dfg_json_lens == nullptr || num_stages == 0) {
+        return DODA_ERROR_INVALID_INPUT;
+    }
+
+    std::string fused;
+    try {
+        std::vector<nlohmann::json> stages;
+        for (size_t i = 0; i < num_stages; i++) {
+            if (dfg_jsons[i] == nullptr) {
+                return DODA_ERROR_INVALID_INPUT;
+            }
+            stages.push_back(nlohmann::json::parse(dfg_jsons[i], dfg_jsons[i] + dfg_json_lens[i]));
+        }
+        fused = doda_mapper::fuse_dfgs(stages).dump(2) + "\n";
+    } catch (const nlohmann::json::exception& e) {
+        std::cerr << "[doda_fuse_dfgs] Invalid DFG JSON: " << e.what() << std::endl;
+        return DODA_ERROR_INVALID_INPUT;
+    } catch (const std::exception& e) {
+        std::cerr << "[doda_fuse_dfgs] " << e.what() << std::endl;
+        return DODA_ERROR_COMPILATION_FAILED;
+    }
+
+    if (fused_len) {
+        *fused_len = fused.size();
+    }
+    if (fused_json == nullptr || capacity < fused.size()) {
+        return DODA_ERROR_BUFFER_TOO_SMALL;
+    }
+    std::copy(fused.begin(), fused.end(), fused_json);
+    return DODA_SUCCESS;
+}
+
+} // extern "C"
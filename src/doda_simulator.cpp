@@ -1,15 +1,145 @@
 #include "doda_simulator.hpp"
+#include "verilated_vcd_c.h"
 #include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
 #include <cassert>
+#include <algorithm>
+#include <deque>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
-DODASimulator::DODASimulator() : doda_(std::make_unique<VDODA>()) {
-    // Initialize Verilator
+DODASimulator::DODASimulator()
+    : context_(std::make_unique<VerilatedContext>()) {
+    // Initialize this instance's Verilator context (no process-global state is touched)
     const char* dummy_argv[] = {nullptr};
-    Verilated::commandArgs(0, dummy_argv);
+    context_->commandArgs(0, dummy_argv);
+    doda_ = std::make_unique<VDODA>(context_.get());
+    bindPorts();
+
+    if (const char* stats_path = std::getenv("DODA_SIM_STATS_JSON")) {
+        stats_json_path_ = stats_path;
+    }
+}
+
+// Accumulates cycles, evals and wall-clock time of one phase into the cumulative and per-run stats
+class DODASimulator::PhaseScope {
+public:
+    PhaseScope(DODASimulator& sim, PhaseStats SimulatorStats::*phase)
+        : PhaseScope(sim, phase, sim.cycle_count_, sim.eval_count_, std::chrono::steady_clock::now()) {}
+    // A phase that started earlier, at the given cycle, eval count and time
+    PhaseScope(DODASimulator& sim, PhaseStats SimulatorStats::*phase, uint64_t cycles, uint64_t evals,
+               std::chrono::steady_clock::time_point start)
+        : sim_(sim), phase_(phase), cycles_(cycles), evals_(evals), start_(start) {}
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+    ~PhaseScope() {
+        const uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+        const uint64_t cycles = sim_.cycle_count_ - cycles_;
+        const uint64_t evals = sim_.eval_count_ - evals_;
+        for (SimulatorStats* stats : {&sim_.stats_, &sim_.run_stats_}) {
+            PhaseStats& phase = stats->*phase_;
+            phase.calls++;
+            phase.cycles += cycles;
+            phase.evals += evals;
+            phase.nanoseconds += ns;
+        }
+    }
+private:
+    DODASimulator& sim_;
+    PhaseStats SimulatorStats::*phase_;
+    uint64_t cycles_;
+    uint64_t evals_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+static void writePhaseJson(std::ostream& os, const char* name, const PhaseStats& phase) {
+    os << "\"" << name << "\": {\"calls\": " << phase.calls << ", \"cycles\": " << phase.cycles
+       << ", \"evals\": " << phase.evals << ", \"ns\": " << phase.nanoseconds << "}";
+}
+
+void SimulatorStats::writeJson(std::ostream& os) const {
+    os << "{";
+    writePhaseJson(os, "program", program);
+    os << ", ";
+    writePhaseJson(os, "load", load);
+    os << ", ";
+    writePhaseJson(os, "run", run);
+    os << ", ";
+    writePhaseJson(os, "readback", readback);
+    os << ", \"load_stall_cycles\": [";
+    for (size_t c = 0; c < sizeof(load_stall_cycles) / sizeof(load_stall_cycles[0]); c++) {
+        os << (c ? ", " : "") << load_stall_cycles[c];
+    }
+    os << "]";
+    os << ", \"total_cycles\": " << total_cycles << ", \"total_evals\": " << total_evals
+       << ", \"runs\": " << runs << ", \"timeouts\": " << timeouts << "}";
+}
+
+SimulatorStats DODASimulator::getStats() const {
+    SimulatorStats stats = stats_;
+    stats.total_cycles = cycle_count_ - stats_base_cycles_;
+    stats.total_evals = eval_count_ - stats_base_evals_;
+    return stats;
+}
+
+void DODASimulator::resetStats() {
+    stats_base_cycles_ = cycle_count_;
+    stats_base_evals_ = eval_count_;
+    stats_ = SimulatorStats();
+    run_stats_ = SimulatorStats();
+}
+
+void DODASimulator::dumpRunStats() {
+    stats_.runs++;
+    run_stats_.runs++;
+    run_stats_.total_cycles = run_stats_.program.cycles + run_stats_.load.cycles +
+                              run_stats_.run.cycles + run_stats_.readback.cycles;
+    run_stats_.total_evals = run_stats_.program.evals + run_stats_.load.evals +
+                             run_stats_.run.evals + run_stats_.readback.evals;
+
+    if (!stats_json_path_.empty()) {
+        std::ofstream out(stats_json_path_, std::ios::app);
+        if (out.is_open()) {
+            run_stats_.writeJson(out);
+            out << "\n";
+        } else {
+            std::cerr << "DODASimulator: Warning: cannot write stats to " << stats_json_path_ << std::endl;
+        }
+    }
+    run_stats_ = SimulatorStats();
+}
+
+void DODASimulator::bindPorts() {
+    // Per-cluster port table, so the drivers index by cluster instead of switching per word
+    ports_[0] = {&doda_->io_v_inst_prog_in_0_valid, &doda_->io_v_inst_prog_in_0_bits[0], &doda_->io_v_in_prog_read_done_0,
+                 &doda_->io_v_t_axi_read_in_0_ready, &doda_->io_v_t_axi_read_in_0_valid, &doda_->io_v_t_axi_read_in_0_bits,
+                 &doda_->io_v_t_axi_write_out_0_ready, &doda_->io_v_t_axi_write_out_0_valid, &doda_->io_v_t_axi_write_out_0_bits,
+                 &doda_->io_v_in_spm_read_done_0};
+    ports_[1] = {&doda_->io_v_inst_prog_in_1_valid, &doda_->io_v_inst_prog_in_1_bits[0], &doda_->io_v_in_prog_read_done_1,
+                 &doda_->io_v_t_axi_read_in_1_ready, &doda_->io_v_t_axi_read_in_1_valid, &doda_->io_v_t_axi_read_in_1_bits,
+                 &doda_->io_v_t_axi_write_out_1_ready, &doda_->io_v_t_axi_write_out_1_valid, &doda_->io_v_t_axi_write_out_1_bits,
+                 &doda_->io_v_in_spm_read_done_1};
+    ports_[2] = {&doda_->io_v_inst_prog_in_2_valid, &doda_->io_v_inst_prog_in_2_bits[0], &doda_->io_v_in_prog_read_done_2,
+                 &doda_->io_v_t_axi_read_in_2_ready, &doda_->io_v_t_axi_read_in_2_valid, &doda_->io_v_t_axi_read_in_2_bits,
+                 &doda_->io_v_t_axi_write_out_2_ready, &doda_->io_v_t_axi_write_out_2_valid, &doda_->io_v_t_axi_write_out_2_bits,
+                 &doda_->io_v_in_spm_read_done_2};
+    ports_[3] = {&doda_->io_v_inst_prog_in_3_valid, &doda_->io_v_inst_prog_in_3_bits[0], &doda_->io_v_in_prog_read_done_3,
+                 &doda_->io_v_t_axi_read_in_3_ready, &doda_->io_v_t_axi_read_in_3_valid, &doda_->io_v_t_axi_read_in_3_bits,
+                 &doda_->io_v_t_axi_write_out_3_ready, &doda_->io_v_t_axi_write_out_3_valid, &doda_->io_v_t_axi_write_out_3_bits,
+                 &doda_->io_v_in_spm_read_done_3};
 }
 
 DODASimulator::~DODASimulator() {
-    // Cleanup handled by unique_ptr
+    // Close the trace before the model goes away; the rest is handled by unique_ptr
+    disableTrace();
 }
 
 void DODASimulator::initialize() {
@@ -18,16 +148,18 @@ void DODASimulator::initialize() {
 
 void DODASimulator::reset() {
     // Reset sequence
-    doda_->clock = 1;
     doda_->reset = 1;
-    doda_->eval();
-    doda_->clock = 0;
-    doda_->eval();
-    doda_->clock = 1;
+    cycle();
     doda_->reset = 0;
+    cycle();
+}
+
+// Clocking: inputs are written while the clock is low and the model is evaluated exactly
+// once per edge. Writing inputs between posedge() and negedge() needs no extra eval(): the
+// negedge evaluation propagates them, and the next posedge samples them.
+void DODASimulator::eval() {
     doda_->eval();
-    doda_->clock = 0;
-    doda_->eval();
+    eval_count_++;
 }
 
 void DODASimulator::cycle() {
@@ -35,14 +167,89 @@ void DODASimulator::cycle() {
     negedge();
 }
 
+void DODASimulator::run(uint64_t cycles) {
+    for (uint64_t i = 0; i < cycles; i++) {
+        posedge();
+        negedge();
+    }
+}
+
+bool DODASimulator::runUntilStatus(Status target_status, uint64_t max_cycles) {
+    // io_status is a plain output field; checking it costs no evaluation
+    for (uint64_t i = 0; i < max_cycles; i++) {
+        if (getStatus() >= target_status) return true;
+        cycle();
+    }
+    return getStatus() >= target_status;
+}
+
 void DODASimulator::posedge() {
     doda_->clock = 1;
-    doda_->eval();
+    eval();
+    cycle_count_++;
+    if (tfp_) traceEdge(true);
 }
 
 void DODASimulator::negedge() {
     doda_->clock = 0;
-    doda_->eval();
+    eval();
+    if (tfp_) traceEdge(false);
+}
+
+void DODASimulator::enableTrace(const TraceOptions& options) {
+    disableTrace();
+    trace_options_ = options;
+    trace_last_status_ = getStatus();
+    trace_triggered_ = options.trigger_from < 0 && options.trigger_to < 0;
+    trace_trigger_cycle_ = cycle_count_;
+    trace_segment_start_ = cycle_count_;
+
+    // The model time never advances (we dump at 2*cycle), so enabling here is still "before time 0"
+    context_->traceEverOn(true);
+    tfp_ = std::make_unique<VerilatedVcdC>();
+    doda_->trace(tfp_.get(), options.levels);
+    tfp_->open(options.path.c_str());
+}
+
+void DODASimulator::disableTrace() {
+    if (tfp_) {
+        tfp_->close();
+        tfp_.reset();
+    }
+}
+
+void DODASimulator::flushTrace() {
+    if (tfp_) tfp_->flush();
+}
+
+void DODASimulator::traceEdge(bool rising) {
+    const TraceOptions& opt = trace_options_;
+    const Status status = getStatus();
+    
+    // Trigger on a status transition
+    if (!trace_triggered_ && status != trace_last_status_ &&
+        (opt.trigger_from < 0 || static_cast<int>(trace_last_status_) == opt.trigger_from) &&
+        (opt.trigger_to < 0 || static_cast<int>(status) == opt.trigger_to)) {
+        trace_triggered_ = true;
+        trace_trigger_cycle_ = cycle_count_;
+    }
+    trace_last_status_ = status;
+    
+    const bool in_window = cycle_count_ >= opt.start_cycle && cycle_count_ < opt.end_cycle;
+    const bool in_phase = (opt.phase_mask & TraceOptions::phaseBit(status)) != 0;
+    const bool in_trigger = trace_triggered_ && cycle_count_ - trace_trigger_cycle_ < opt.trigger_cycles;
+    if (!(in_window && in_phase && in_trigger)) return;
+    
+    // Ring buffer: rotate the current segment to <path>.prev and reopen <path>, which writes
+    // a fresh header and a full dump so each segment is a complete VCD on its own
+    if (opt.ring_cycles > 0 && rising && cycle_count_ - trace_segment_start_ >= opt.ring_cycles) {
+        tfp_->close();
+        std::rename(opt.path.c_str(), (opt.path + ".prev").c_str());
+        tfp_->open(opt.path.c_str());
+        trace_segment_start_ = cycle_count_;
+    }
+    
+    tfp_->dump(cycle_count_ * 2 + (rising ? 0 : 1));
 }
 
 DODASimulator::Status DODASimulator::getStatus() const {
@@ -58,48 +265,47 @@ bool DODASimulator::isDone() const {
 }
 
 void DODASimulator::programInstructions(const std::vector<std::vector<std::string>>& binary_instructions) {
+    // Text instructions are packed once up front; the programming loop only moves words
+    programInstructions(PackedBitstream::fromText(binary_instructions));
+}
+
+void DODASimulator::programInstructions(const PackedBitstream& bitstream) {
+    programInstructions(bitstream.data(), bitstream.numClusters(), bitstream.numPePerCluster());
+}
+
+void DODASimulator::programInstructions(const uint32_t* packed_words, int num_clusters, int num_pe_per_cluster) {
+    PhaseScope phase(*this, &SimulatorStats::program);
+    
     // Send init signal to enter programming mode
     sendInitSignal();
     
-    // Wait for BEING_PROGRAMMED status
-    waitForStatus(Status::BEING_PROGRAMMED);
+    // Wait for BEING_PROGRAMMED status, bounded so that an ignored init cannot hang the host
+    const uint64_t max_init_cycles = 1000;
+    if (!waitForStatus(Status::BEING_PROGRAMMED, max_init_cycles)) {
+        throw std::runtime_error("DODASimulator: did not enter programming mode within " +
+                                 std::to_string(max_init_cycles) + " cycles (status " +
+                                 std::to_string(static_cast<int>(getStatus())) + ")");
+    }
     
     General_Params g;
+    static const uint32_t zero_instruction[PackedBitstream::WORDS_PER_INSTRUCTION] = {0, 0, 0, 0};
+    const int words_per_inst = PackedBitstream::WORDS_PER_INSTRUCTION;
     
     // Program instructions for each cluster
-    for (int inst_tab_idx = 0; inst_tab_idx < std::min(g.inst_tab_size, static_cast<int>(binary_instructions[0].size())); inst_tab_idx++) {
+    for (int inst_tab_idx = 0; inst_tab_idx < std::min(g.inst_tab_size, num_pe_per_cluster); inst_tab_idx++) {
         posedge();
         
-        // Enable programming for all clusters
-        doda_->io_v_inst_prog_in_0_valid = 1;
-        doda_->io_v_inst_prog_in_1_valid = 1;
-        doda_->io_v_inst_prog_in_2_valid = 1;
-        doda_->io_v_inst_prog_in_3_valid = 1;
-
-        // Program each cluster
-        for (int cluster = 0; cluster < 4; cluster++) {
-            const std::string& bitstr = binary_instructions[cluster][inst_tab_idx];
-            
-            // std::cout << "DEBUG: cluster=" << cluster << " inst_tab_idx=" << inst_tab_idx 
-            //           << " bitstr.length()=" << bitstr.length() 
-            //           << " bitstr=" << bitstr.substr(0, std::min(50, (int)bitstr.length())) << "..." << std::endl;
-            
-            // Split 128-bit instruction into 4 32-bit chunks
-            for (int i = 0; i < 4; i++) {
-                std::string slice = bitstr.substr(128 - (i + 1) * 32, 32);
-                uint32_t value = std::stoul(slice, nullptr, 2);
-                
-                switch (cluster) {
-                    case 0: doda_->io_v_inst_prog_in_0_bits[i] = value; break;
-                    case 1: doda_->io_v_inst_prog_in_1_bits[i] = value; break;
-                    case 2: doda_->io_v_inst_prog_in_2_bits[i] = value; break;
-                    case 3: doda_->io_v_inst_prog_in_3_bits[i] = value; break;
-                }
-            }
+        // Enable programming for all clusters (clusters missing from the bitstream get an all-zero instruction)
+        for (int cluster = 0; cluster < NUM_PORTS; cluster++) {
+            const uint32_t* words = cluster < num_clusters
+                ? packed_words + (static_cast<size_t>(cluster) * num_pe_per_cluster + inst_tab_idx) * words_per_inst
+                : zero_instruction;
+            *ports_[cluster].inst_valid = 1;
+            std::memcpy(ports_[cluster].inst_bits, words, words_per_inst * sizeof(uint32_t));
         }
         
-        doda_->eval();
         negedge();
+        evals_saved_++;
     }
     
     // Clear programming signals
@@ -109,83 +315,159 @@ void DODASimulator::programInstructions(const std::vector<std::vector<std::strin
     signalProgrammingDone();
 }
 
-void DODASimulator::loadMemoryData(const std::vector<std::vector<int>>& memory_data) {
+void DODASimulator::loadMemoryData(const std::vector<std::vector<int>>& memory_data, bool pad_to_capacity) {
+    PhaseScope phase(*this, &SimulatorStats::load);
     General_Params g;
     
-    // Load data into scratchpad memories
-    int cnt = 0;
-    int mem0_size = memory_data.size() > 0? static_cast<int>(memory_data[0].size()): 0;
-    int mem1_size = memory_data.size() > 1? static_cast<int>(memory_data[1].size()): 0;
-    int mem2_size = memory_data.size() > 2? static_cast<int>(memory_data[2].size()): 0;
-    int mem3_size = memory_data.size() > 3? static_cast<int>(memory_data[3].size()): 0;
-
-    while (cnt < g.num_data_mem_entries && 
-           doda_->io_v_t_axi_read_in_0_ready && 
-           doda_->io_v_t_axi_read_in_1_ready && 
-           doda_->io_v_t_axi_read_in_2_ready && 
-           doda_->io_v_t_axi_read_in_3_ready) {
+    for (size_t c = 0; c < memory_data.size(); c++) {
+        if (static_cast<int>(memory_data[c].size()) > g.num_data_mem_entries) {
+            std::cerr << "DODASimulator: Warning: cluster " << c << " memory image has " << memory_data[c].size()
+                      << " words; only the first " << g.num_data_mem_entries << " fit in the scratchpad." << std::endl;
+        }
+    }
+
+    // One queue per cluster port. Without padding, a cluster only sees traffic for the words it was given.
+    struct PortQueue {
+        const std::vector<int>* data;
+        int next;       // Index of the beat currently offered on the port
+        int size;       // Beats to send
+    };
+    PortQueue queues[NUM_PORTS];
+    for (int c = 0; c < NUM_PORTS; c++) {
+        const bool has_data = c < static_cast<int>(memory_data.size());
+        const int data_size = has_data ? std::min(static_cast<int>(memory_data[c].size()), g.num_data_mem_entries) : 0;
+        queues[c] = {has_data ? &memory_data[c] : nullptr, 0, pad_to_capacity ? g.num_data_mem_entries : data_size};
+    }
+    
+    auto drive = [&]() {
+        for (int c = 0; c < NUM_PORTS; c++) {
+            const PortQueue& q = queues[c];
+            const bool valid = q.next < q.size;
+            *ports_[c].spm_in_valid = valid ? 1 : 0;
+            *ports_[c].spm_in_bits = (valid && q.data && q.next < static_cast<int>(q.data->size()))
+                ? static_cast<IData>((*q.data)[q.next]) : 0;
+        }
+    };
+    auto pending = [&]() {
+        for (int c = 0; c < NUM_PORTS; c++) {
+            if (queues[c].next < queues[c].size) return true;
+        }
+        return false;
+    };
+
+    // Offer the first beat of every queue
+    posedge();
+    drive();
+    negedge();
+    evals_saved_++;
+
+    // Each port advances on its own valid/ready handshake; a beat transfers on the posedge where
+    // the port was valid and ready (ready as evaluated at the preceding negedge).
+    const uint64_t max_stall_cycles = 16 * static_cast<uint64_t>(g.num_data_mem_entries);
+    uint64_t stalled_for = 0;
+    while (pending() && stalled_for < max_stall_cycles) {
+        bool accepted[NUM_PORTS];
+        bool progress = false;
+        for (int c = 0; c < NUM_PORTS; c++) {
+            const bool valid = queues[c].next < queues[c].size;
+            accepted[c] = valid && *ports_[c].spm_in_ready;
+            if (valid && !accepted[c]) {
+                stats_.load_stall_cycles[c]++;
+                run_stats_.load_stall_cycles[c]++;
+            }
+            progress = progress || accepted[c];
+        }
         
         posedge();
-        doda_->io_v_t_axi_read_in_0_valid = 1;
-        doda_->io_v_t_axi_read_in_0_bits = cnt<mem0_size? memory_data[0][cnt]: 0;
-        doda_->io_v_t_axi_read_in_1_valid = 1;
-        doda_->io_v_t_axi_read_in_1_bits = cnt<mem1_size? memory_data[1][cnt]: 0;
-        doda_->io_v_t_axi_read_in_2_valid = 1;
-        doda_->io_v_t_axi_read_in_2_bits = cnt<mem2_size? memory_data[2][cnt]: 0;
-        doda_->io_v_t_axi_read_in_3_valid = 1;
-        doda_->io_v_t_axi_read_in_3_bits = cnt<mem3_size? memory_data[3][cnt]: 0;
-        
-        doda_->eval();
+        for (int c = 0; c < NUM_PORTS; c++) {
+            if (accepted[c]) queues[c].next++;
+        }
+        drive();
         negedge();
-        cnt++;
+        evals_saved_++;
+        
+        stalled_for = progress ? 0 : stalled_for + 1;
     }
     
-    // Clear memory signals
-    clearMemorySignals();
+    if (pending()) {
+        std::cerr << "DODASimulator: Warning: SPM load stalled for " << max_stall_cycles
+                  << " cycles; memory is only partially loaded." << std::endl;
+        clearMemorySignals();
+    }
     
-    // Signal memory loading completion
+    // Signal memory loading completion (every queue has drained, so all valids are already low)
     signalMemoryLoadDone();
 }
 
 void DODASimulator::startExecution() {
+    // Accounted by waitForCompletion, so a run counts as one call
+    run_started_ = true;
+    run_start_cycles_ = cycle_count_;
+    run_start_evals_ = eval_count_;
+    run_start_time_ = std::chrono::steady_clock::now();
+    
     // Send init signal to start execution
     sendInitSignal();
 }
 
 void DODASimulator::waitForCompletion(int max_cycles) {
-    int cycle = 0;
-    while (getStatus() < Status::DONE && cycle < max_cycles) {
-        this->cycle();
-        cycle++;
+    if (!run_started_) {
+        run_start_cycles_ = cycle_count_;
+        run_start_evals_ = eval_count_;
+        run_start_time_ = std::chrono::steady_clock::now();
     }
+    run_started_ = false;
+    PhaseScope phase(*this, &SimulatorStats::run, run_start_cycles_, run_start_evals_, run_start_time_);
+    const uint64_t start_cycle = cycle_count_;
+    runUntilStatus(Status::DONE, static_cast<uint64_t>(std::max(0, max_cycles)));
     
     if (getStatus() == Status::DONE) {
-        std::cout << "DODASimulator: Execution completed successfully." << std::endl;
+        std::cout << "DODASimulator: Execution completed successfully in "
+                  << (cycle_count_ - start_cycle) << " cycles." << std::endl;
     } else {
+        stats_.timeouts++;
+        run_stats_.timeouts++;
         std::cout << "DODASimulator: Execution timeout after " << max_cycles << " cycles." << std::endl;
+        if (tfp_) {
+            // Make the cycles leading up to the hang available on disk
+            tfp_->flush();
+            std::cout << "DODASimulator: Trace written to " << trace_options_.path
+                      << (trace_options_.ring_cycles > 0 ? " (and " + trace_options_.path + ".prev)" : "") << std::endl;
+        }
     }
 }
 
 std::vector<std::vector<int>> DODASimulator::readMemory() {
+    std::vector<std::vector<int>> memory_out;
+    {
+        PhaseScope phase(*this, &SimulatorStats::readback);
+        memory_out = drainMemory();
+    }
+    
+    // A readback completes a run
+    dumpRunStats();
+    return memory_out;
+}
+
+std::vector<std::vector<int>> DODASimulator::drainMemory() {
     General_Params g;
-    std::vector<std::vector<int>> memory_out(4);
+    std::vector<std::vector<int>> memory_out(NUM_PORTS);
+    for (auto& mem : memory_out) {
+        mem.reserve(g.num_data_mem_entries);
+    }
     
     int mem_out_cnt = 0;
     while (mem_out_cnt < g.num_data_mem_entries) {
         posedge();
-        
-        doda_->io_v_t_axi_write_out_0_ready = 1;
-        doda_->io_v_t_axi_write_out_1_ready = 1;
-        doda_->io_v_t_axi_write_out_2_ready = 1;
-        doda_->io_v_t_axi_write_out_3_ready = 1;
-        
-        doda_->eval();
+        for (int c = 0; c < NUM_PORTS; c++) {
+            *ports_[c].spm_out_ready = 1;
+        }
         negedge();
+        evals_saved_++;
         
-        memory_out[0].push_back(doda_->io_v_t_axi_write_out_0_valid ? doda_->io_v_t_axi_write_out_0_bits : -1);
-        memory_out[1].push_back(doda_->io_v_t_axi_write_out_1_valid ? doda_->io_v_t_axi_write_out_1_bits : -1);
-        memory_out[2].push_back(doda_->io_v_t_axi_write_out_2_valid ? doda_->io_v_t_axi_write_out_2_bits : -1);
-        memory_out[3].push_back(doda_->io_v_t_axi_write_out_3_valid ? doda_->io_v_t_axi_write_out_3_bits : -1);
+        for (int c = 0; c < NUM_PORTS; c++) {
+            memory_out[c].push_back(*ports_[c].spm_out_valid ? static_cast<int>(*ports_[c].spm_out_bits) : -1);
+        }
         
         mem_out_cnt++;
     }
@@ -193,6 +475,176 @@ std::vector<std::vector<int>> DODASimulator::readMemory() {
     return memory_out;
 }
 
+std::vector<std::vector<uint32_t>> DODASimulator::readMemory(const std::vector<SpmRange>& ranges, int max_idle_cycles) {
+    std::vector<std::vector<uint32_t>> memory_out(ranges.size());
+    {
+        PhaseScope phase(*this, &SimulatorStats::readback);
+        General_Params g;
+        
+        // The write-out ports stream words from address 0, one per valid/ready handshake.
+        // Only ports with a non-empty range are drained, and only up to the end of their range.
+        int end[NUM_PORTS];
+        int begin[NUM_PORTS];
+        int received[NUM_PORTS];
+        for (int c = 0; c < NUM_PORTS; c++) {
+            const bool has_range = c < static_cast<int>(ranges.size()) && ranges[c].end > ranges[c].begin;
+            begin[c] = has_range ? std::max(0, ranges[c].begin) : 0;
+            end[c] = has_range ? std::min(ranges[c].end, g.num_data_mem_entries) : 0;
+            received[c] = 0;
+            if (has_range) {
+                memory_out[c].reserve(end[c] - begin[c]);
+            }
+        }
+        
+        auto pending = [&]() {
+            for (int c = 0; c < NUM_PORTS; c++) {
+                if (received[c] < end[c]) return true;
+            }
+            return false;
+        };
+        
+        int idle_cycles = 0;
+        while (pending() && idle_cycles < max_idle_cycles) {
+            // The posedge consumes the beats accepted in the previous iteration
+            posedge();
+            for (int c = 0; c < NUM_PORTS; c++) {
+                *ports_[c].spm_out_ready = received[c] < end[c] ? 1 : 0;
+            }
+            negedge();
+            evals_saved_++;
+            
+            bool progress = false;
+            for (int c = 0; c < NUM_PORTS; c++) {
+                if (*ports_[c].spm_out_ready && *ports_[c].spm_out_valid) {
+                    if (received[c] >= begin[c]) {
+                        memory_out[c].push_back(static_cast<uint32_t>(*ports_[c].spm_out_bits));
+                    }
+                    received[c]++;
+                    progress = true;
+                }
+            }
+            idle_cycles = progress ? 0 : idle_cycles + 1;
+        }
+        
+        if (pending()) {
+            std::cerr << "DODASimulator: Warning: readback stalled for " << max_idle_cycles
+                      << " cycles; returning partial data." << std::endl;
+        }
+        
+        // Complete the last handshake and release the ports
+        posedge();
+        for (int c = 0; c < NUM_PORTS; c++) {
+            *ports_[c].spm_out_ready = 0;
+        }
+        negedge();
+        evals_saved_++;
+    }
+    
+    // A readback completes a run
+    dumpRunStats();
+    return memory_out;
+}
+
+std::vector<std::vector<std::vector<int>>> DODASimulator::snapshotAndFork(
+        const std::vector<std::vector<std::vector<int>>>& memory_images, int max_workers, int max_cycles) {
+    General_Params g;
+    const int num_images = static_cast<int>(memory_images.size());
+    std::vector<std::vector<std::vector<int>>> results(num_images);
+    if (num_images == 0) return results;
+
+    if (max_workers <= 0) {
+        max_workers = std::max(1, static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN)));
+    }
+    const int num_workers = std::min(max_workers, num_images);
+
+    // One shared slot per image: [status][num_cluster x num_data_mem_entries words]
+    enum : int32_t { SLOT_PENDING = 0, SLOT_DONE = 1, SLOT_TIMEOUT = 2 };
+    const size_t slot_words = 1 + static_cast<size_t>(g.num_cluster) * g.num_data_mem_entries;
+    const size_t shm_size = slot_words * num_images * sizeof(int32_t);
+    void* shm = mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shm == MAP_FAILED) {
+        throw std::runtime_error("DODASimulator: failed to allocate shared result memory");
+    }
+    int32_t* slots = static_cast<int32_t*>(shm);
+    std::memset(slots, 0, shm_size);
+
+    std::cout.flush();
+    std::cerr.flush();
+
+    // Release model resources that must not be shared across fork()
+    doda_->prepareClone();
+    // One child per image, each forked from the programmed state; at most num_workers are live
+    std::deque<pid_t> children;
+    auto reap_oldest = [&]() {
+        int wstatus = 0;
+        while (waitpid(children.front(), &wstatus, 0) < 0 && errno == EINTR) {}
+        children.pop_front();
+    };
+    int num_forked = 0;
+    for (; num_forked < num_images; num_forked++) {
+        if (static_cast<int>(children.size()) == num_workers) {
+            reap_oldest();
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            break;
+        }
+        if (pid == 0) {
+            // Child: run this one image and exit, whatever state the fabric is left in
+            doda_->atClone();
+            // The trace file belongs to the parent; children run untraced
+            tfp_.release();
+            int32_t* slot = slots + slot_words * num_forked;
+            loadMemoryData(memory_images[num_forked]);
+            startExecution();
+            waitForCompletion(max_cycles);
+            if (!isDone()) {
+                __atomic_store_n(slot, static_cast<int32_t>(SLOT_TIMEOUT), __ATOMIC_RELEASE);
+                std::cout.flush();
+                _exit(0);
+            }
+            std::vector<std::vector<int>> memory_out = readMemory();
+            for (int c = 0; c < g.num_cluster; c++) {
+                const size_t n = std::min(memory_out[c].size(), static_cast<size_t>(g.num_data_mem_entries));
+                std::memcpy(slot + 1 + static_cast<size_t>(c) * g.num_data_mem_entries,
+                            memory_out[c].data(), n * sizeof(int32_t));
+            }
+            __atomic_store_n(slot, static_cast<int32_t>(SLOT_DONE), __ATOMIC_RELEASE);
+            std::cout.flush();
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    while (!children.empty()) {
+        reap_oldest();
+    }
+    doda_->atClone();
+
+    for (int img = 0; img < num_images; img++) {
+        const int32_t* slot = slots + slot_words * img;
+        const int32_t status = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (status == SLOT_PENDING) {
+            std::cerr << "DODASimulator: snapshot worker for image " << img
+                      << (img >= num_forked ? " could not be forked; image not run." : " did not complete.")
+                      << std::endl;
+            continue;
+        }
+        if (status == SLOT_TIMEOUT) {
+            std::cerr << "DODASimulator: snapshot image " << img << " did not finish within "
+                      << max_cycles << " cycles." << std::endl;
+            continue;
+        }
+        results[img].resize(g.num_cluster);
+        for (int c = 0; c < g.num_cluster; c++) {
+            const int32_t* words = slot + 1 + static_cast<size_t>(c) * g.num_data_mem_entries;
+            results[img][c].assign(words, words + g.num_data_mem_entries);
+        }
+    }
+
+    munmap(shm, shm_size);
+    return results;
+}
+
 // Helper methods
 void DODASimulator::setSignal(bool& signal, bool value) {
     signal = value;
@@ -201,90 +653,73 @@ void DODASimulator::setSignal(bool& signal, bool value) {
 void DODASimulator::pulseSignal(bool& signal) {
     posedge();
     signal = 1;
-    doda_->eval();
     negedge();
     posedge();
     signal = 0;
-    doda_->eval();
     negedge();
+    evals_saved_ += 2;
 }
 
 void DODASimulator::pulseSignal(CData& signal) {
     posedge();
     signal = 1;
-    doda_->eval();
     negedge();
     posedge();
     signal = 0;
-    doda_->eval();
     negedge();
+    evals_saved_ += 2;
 }
 
 void DODASimulator::clearProgrammingSignals() {
     posedge();
-    doda_->io_v_inst_prog_in_0_valid = 0;
-    doda_->io_v_inst_prog_in_1_valid = 0;
-    doda_->io_v_inst_prog_in_2_valid = 0;
-    doda_->io_v_inst_prog_in_3_valid = 0;
-    doda_->eval();
+    for (int c = 0; c < NUM_PORTS; c++) {
+        *ports_[c].inst_valid = 0;
+    }
     negedge();
+    evals_saved_++;
 }
 
 void DODASimulator::clearMemorySignals() {
     posedge();
-    doda_->io_v_t_axi_read_in_0_valid = 0;
-    doda_->io_v_t_axi_read_in_1_valid = 0;
-    doda_->io_v_t_axi_read_in_2_valid = 0;
-    doda_->io_v_t_axi_read_in_3_valid = 0;
-    doda_->eval();
+    for (int c = 0; c < NUM_PORTS; c++) {
+        *ports_[c].spm_in_valid = 0;
+    }
     negedge();
+    evals_saved_++;
 }
 
-void DODASimulator::waitForStatus(Status target_status) {
-    while (getStatus() != target_status) {
+bool DODASimulator::waitForStatus(Status target_status, uint64_t max_cycles) {
+    for (uint64_t i = 0; i < max_cycles && getStatus() != target_status; i++) {
         cycle();
     }
+    return getStatus() == target_status;
 }
 
 void DODASimulator::sendInitSignal() {
     pulseSignal(doda_->io_init);
 }
 
-void DODASimulator::signalProgrammingDone() {
+void DODASimulator::pulseClusterSignal(CData* ClusterPorts::*signal) {
     posedge();
-    doda_->io_v_in_prog_read_done_0 = 1;
-    doda_->io_v_in_prog_read_done_1 = 1;
-    doda_->io_v_in_prog_read_done_2 = 1;
-    doda_->io_v_in_prog_read_done_3 = 1;
-    doda_->eval();
+    for (int c = 0; c < NUM_PORTS; c++) {
+        *(ports_[c].*signal) = 1;
+    }
     negedge();
-    
     posedge();
-    doda_->io_v_in_prog_read_done_0 = 0;
-    doda_->io_v_in_prog_read_done_1 = 0;
-    doda_->io_v_in_prog_read_done_2 = 0;
-    doda_->io_v_in_prog_read_done_3 = 0;
-    doda_->eval();
+    for (int c = 0; c < NUM_PORTS; c++) {
+        *(ports_[c].*signal) = 0;
+    }
     negedge();
+    evals_saved_ += 2;
+}
+
+void DODASimulator::signalProgrammingDone() {
+    pulseClusterSignal(&ClusterPorts::prog_read_done);
 }
 
 void DODASimulator::signalMemoryLoadDone() {
-    posedge();
-    doda_->io_v_in_spm_read_done_0 = 1;
-    doda_->io_v_in_spm_read_done_1 = 1;
-    doda_->io_v_in_spm_read_done_2 = 1;
-    doda_->io_v_in_spm_read_done_3 = 1;
-    doda_->eval();
-    negedge();
-    
-    posedge();
-    doda_->io_v_in_spm_read_done_0 = 0;
-    doda_->io_v_in_spm_read_done_1 = 0;
-    doda_->io_v_in_spm_read_done_2 = 0;
-    doda_->io_v_in_spm_read_done_3 = 0;
-    doda_->eval();
-    negedge();
+    pulseClusterSignal(&ClusterPorts::spm_read_done);
     
     // Additional cycle for state transition
     cycle();
-}
\ No newline at end of file
+}
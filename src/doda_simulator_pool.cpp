@@ -0,0 +1,147 @@
+#include "doda_simulator_pool.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+DODASimulatorPool::DODASimulatorPool(unsigned num_workers) {
+    if (num_workers == 0) {
+        num_workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < num_workers; i++) {
+        queues_.push_back(std::make_unique<WorkQueue>());
+    }
+    for (unsigned i = 0; i < num_workers; i++) {
+        workers_.emplace_back(&DODASimulatorPool::workerLoop, this, i);
+    }
+}
+
+DODASimulatorPool::~DODASimulatorPool() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+std::future<DODASimulatorPool::Result> DODASimulatorPool::submit(SimulationJob job) {
+    if (!job.bitstream) {
+        throw std::invalid_argument("DODASimulatorPool: job has no bitstream");
+    }
+
+    std::unique_ptr<Task> task = std::make_unique<Task>();
+    task->job = std::move(job);
+    std::future<Result> result = task->promise.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        pending_++;
+        queued_++;
+    }
+    unsigned queue_idx = next_queue_.fetch_add(1) % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue_idx]->mutex);
+        queues_[queue_idx]->tasks.push_back(std::move(task));
+    }
+    wake_cv_.notify_one();
+    return result;
+}
+
+std::future<DODASimulatorPool::Result> DODASimulatorPool::submit(std::shared_ptr<const PackedBitstream> bitstream,
+                                                                 std::vector<std::vector<int>> memory_image,
+                                                                 int max_cycles) {
+    SimulationJob job;
+    job.bitstream = std::move(bitstream);
+    job.memory_image = std::move(memory_image);
+    job.max_cycles = max_cycles;
+    return submit(std::move(job));
+}
+
+void DODASimulatorPool::waitIdle() {
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    idle_cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+std::unique_ptr<DODASimulatorPool::Task> DODASimulatorPool::popLocal(unsigned worker_idx) {
+    WorkQueue& queue = *queues_[worker_idx];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return nullptr;
+    std::unique_ptr<Task> task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return task;
+}
+
+std::unique_ptr<DODASimulatorPool::Task> DODASimulatorPool::steal(unsigned thief_idx) {
+    for (size_t i = 1; i < queues_.size(); i++) {
+        WorkQueue& victim = *queues_[(thief_idx + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            std::unique_ptr<Task> task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            jobs_stolen_++;
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void DODASimulatorPool::workerLoop(unsigned worker_idx) {
+    WorkerState state;
+
+    while (true) {
+        std::unique_ptr<Task> task = popLocal(worker_idx);
+        if (!task) task = steal(worker_idx);
+
+        if (!task) {
+            // Sleep until something is queued; remaining jobs are drained before shutdown
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_cv_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+            if (stopping_ && queued_ == 0) return;
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            queued_--;
+        }
+
+        try {
+            task->promise.set_value(runJob(state, task->job));
+        } catch (...) {
+            task->promise.set_exception(std::current_exception());
+            // The simulator may be in an arbitrary state; start the next job from scratch
+            state.simulator.reset();
+            state.programmed.reset();
+        }
+
+        jobs_completed_++;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            pending_--;
+        }
+        idle_cv_.notify_all();
+    }
+}
+
+DODASimulatorPool::Result DODASimulatorPool::runJob(WorkerState& state, const SimulationJob& job) {
+    const bool same_program = state.programmed &&
+        (state.programmed == job.bitstream || state.programmed->sameContent(*job.bitstream));
+
+    if (!state.simulator) {
+        state.simulator = std::make_unique<DODASimulator>();
+        state.simulator->initialize();
+    } else if (!same_program) {
+        state.simulator->reset();
+    }
+
+    if (!same_program) {
+        state.simulator->programInstructions(*job.bitstream);
+        state.programmed = job.bitstream;
+    }
+
+    state.simulator->loadMemoryData(job.memory_image);
+    state.simulator->startExecution();
+    state.simulator->waitForCompletion(job.max_cycles);
+    return state.simulator->readMemory();
+}